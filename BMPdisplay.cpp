@@ -31,10 +31,15 @@
  *
  * This program takes a 24 bit color bmp image and converts it to 8 bit 
  * monochrome image which is then converted into a quadtree. The quadtree is 
- * then decoded into a new image. Pressing the spacebar 
+ * then drawn next to the original image. Pressing the spacebar 
  * toggles an overlay outlining the regions where pixels of similar intensity 
  * have been averaged together
  *
+ * Both images show the same view, which can be zoomed and panned. Only the
+ * visible part of the tree is drawn, at screen resolution, stopping at
+ * regions smaller than a screen pixel, so redrawing costs the same for an
+ * image of any size.
+ *
  * As the quality factor increases, we soon see a significant drop in file size.
  * With very low quality factors, the compression method creates a larger file
  * because of the quadtree overhead. There is a range at which the picture
@@ -54,13 +59,26 @@
  * 
  * @par Usage: 
    @verbatim  
-   c:\> ./quadTree [bmp image filename] [fudge factor] 
-   d:\> c:\bin\./quadTree [bmp image filename] [fudge factor]
+   c:\> ./quadTree [bmp image filename] [fudge factor] [criterion]
+   d:\> c:\bin\./quadTree [bmp image filename] [fudge factor] [criterion]
 
    Where filename is the name of the image file, fudge factor is the 
-   tolerance level or compression factor. Both arguments without brackets.
+   tolerance level or compression factor. All arguments without brackets.
+   Criterion is optional and picks the test used to divide a region:
+     max      - any pixel more than fudge from the mean (default)
+     variance - variance of the region more than fudge squared
+     sse      - sum of squared error of the region more than fudge
    
+   Setting QT_CACHE_DIR keeps encoded trees in that directory so the same
+   image, fudge factor and criterion are only encoded once. QT_CACHE_MB
+   limits the size of the directory in megabytes (default 256).
+
+   The MSE and PSNR of the encoded image are always printed. Setting
+   QT_SSIM=1 decodes the tree and prints its SSIM against the image too.
+
    Spacebar toggles the quadtree overlay
+   Mouse wheel, + and - zoom in and out, 0 fits the image in the window
+   Dragging with the left button or the arrow keys pan
    Escape exits the program
    @endverbatim 
  *
@@ -88,25 +106,53 @@
 #include <iostream>
 #include <GL/glut.h>
 #include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <thread>
 #include <GL/freeglut.h>
 #include "quadTree.h"
 #include "globals.h"
+#include "treeStats.h"
+#include "encodeCache.h"
+#include "quality.h"
 
 using namespace std;
 
 ///Key constant used for keyboard input
 const int EscapeKey = 27;
 
+///Height of the strip above the images holding their titles
+const int TitleHeight = 24;
+
+///Largest width and height an image gets in the initial window
+const int MaxPanel = 960;
+
+///Most screen pixels per image pixel
+const double MaxZoom = 64;
+
+///Whether the left button is held down, and where it was last seen
+static bool dragging = false;
+static int dragX, dragY;
+
 // OpenGL callback function prototypes
 void display( void );
 void reshape( int w, int h );
 void keyboard( unsigned char key, int x, int y );
+void special( int key, int x, int y );
+void mouse( int button, int state, int x, int y );
+void motion( int x, int y );
 
 // other function prototypes
 void initOpenGL( const char *filename, int nrows, int ncols );
 bool LoadBmpFile( const char* filename, int &nrows, int &ncols, byte* &image );
+void ConvertToMonochrome( const byte* BMPimage, int nrows, int ncols, byte* image, unsigned long long* hash = NULL );
 void displayColor( int x, int y, int w, int h, byte *image );
 void displayMonochrome( int x, int y, int w, int h, byte *image );
+void rasterizeImage( byte *out, int w, int h );
+void fitView( void );
+void zoomAt( double factor, int x, int y );
 void imageInfo( char *argv);
 void DrawTextString (char *string, int x, int y, const float color[]);
 
@@ -117,8 +163,9 @@ void DrawTextString (char *string, int x, int y, const float color[]);
  *
  * @par Description: 
  * Checks for proper arguments, converts color array to monochrome,
- * initializes openGL and glut, calls functions: LoadBmpFile, ourTree->fillTree,
- * imageInfo, glutInit, initOpenGL, glutMainLoop
+ * initializes openGL and glut, calls functions: LoadBmpFile, 
+ * ConvertToMonochrome, ourTree->fillTree, imageInfo, glutInit, initOpenGL,
+ * glutMainLoop
  * 
  * @param[in]	argc - number of arguments
  * @param[in]	*argv[] - 2 arguments: image name and quality factor
@@ -128,35 +175,52 @@ void DrawTextString (char *string, int x, int y, const float color[]);
  *****************************************************************************/
 int main( int argc, char *argv[] )
 {
-    if ( argc < 2 )
+    if ( argc < 3 )
     {
-        cerr << "Usage: BMPdisplay image.bmp\n";
+        cerr << "Usage: quadTree image.bmp fudge [max|variance|sse]\n";
         return -1;
     }
 
     // read image file
+    STATS_START( statsStart );
     if ( !LoadBmpFile( argv[1], nrows, ncols, BMPimage ) )
     {
         cerr << "Error: unable to load " << argv[1] << endl;
         return -1;
     }
+    STATS_PHASE( "load", statsStart );
     cerr << "reading " << argv[1] << ": " << nrows << " x " << ncols << endl;
+    if ( !powerOfTwo( nrows ) || !powerOfTwo( ncols ) )
+    {
+        cerr << "Error: both sides of the image must be powers of two" << endl;
+        return -1;
+    }
 	fudge = atoi(argv[2]);
+	if ( argc > 3 && !parseCriterion( argv[3], criterion ) )
+	{
+		cerr << "Error: unknown criterion " << argv[3] << endl;
+		return -1;
+	}
 	
     // convert 24-bit color BMP image to 8-bit monochrome image
-    image = new byte [nrows * ncols ];
-    image2 = new byte [ nrows * ncols ];
-    image3 = new byte [ nrows * ncols ];
-    byte* BMPptr = BMPimage, *imageptr = image;
-    for ( int row = 0; row < nrows; row++ )
-        for ( int col = 0; col < ncols; col++ )
-        {
-            *imageptr++ = 0.30 * BMPptr[0] + 0.59 * BMPptr[1] + 0.11 * BMPptr[2] + 0.5;
-            BMPptr += 3;
-        }
+    STATS_START( convertStart );
+    image = new byte [ size_t( nrows ) * ncols ];
+    unsigned long long hash;
+    ConvertToMonochrome( BMPimage, nrows, ncols, image, &hash );
+    STATS_PHASE( "convert", convertStart );
         
-    //Fill the tree and print out the image information
-	ourTree->fillTree(ourTree->root, 0, 0, nrows);
+    //Fill the tree unless the cache already has it and print out the image
+    //information. The tree is drawn straight from its nodes, see display.
+    encodeCache cache;
+    STATS_START( buildStart );
+	ourTree->setImage( image, nrows, ncols, fudge, criterion );
+	if ( !cache.lookup( hash, fudge, criterion, *ourTree ) )
+	{
+		ourTree->fillTree(ourTree->root, 0, 0, nrows);
+		if ( cache.enabled() )
+			cache.store( hash, fudge, criterion, *ourTree );
+	}
+    STATS_PHASE( "build", buildStart );
 	imageInfo( argv[1]);
 	
     // perform various OpenGL initializations
@@ -174,7 +238,14 @@ int main( int argc, char *argv[] )
  * @author Chris Hjelmfelt
  * 
  * @par Description: 
- * Print out information about the images and nodes for the user
+ * Print out information about the images and nodes for the user, the
+ * quality of the encoded image. The MSE and PSNR come from the tree; the
+ * SSIM, if $QT_SSIM is set, needs the tree decoded into image2. If
+ * $QT_SEGMENT is set, also prints the number of regions left when adjacent
+ * leaves with means within the fudge factor of each other are joined
+ * (quadTree::segment) and the size of the segmented tree
+ * (quadTree::saveSegmented) next to the plain one, after checking that the
+ * segmented tree reads back and decodes to the segmented image.
  *
  * 
  * 
@@ -183,13 +254,69 @@ int main( int argc, char *argv[] )
  *****************************************************************************/
 void imageInfo( char *argv)
 {
-	cout << ncols * nrows << " 8-bit pixels in image (" << ncols * nrows <<
-		 " bytes)." << endl;
+	cout << (long long) ncols * nrows << " 8-bit pixels in image (" <<
+		(long long) ncols * nrows << " bytes)." << endl;
 	cout << ourTree->nodes() << " nodes and " << ourTree->leaves() << 
 		" leaves in quadtree (" << 2 * ourTree->leaves() << " bytes)." << endl;
 	cout << "The quadtree size is about " << 
-		int(100 * float(2 * ourTree->leaves()) / (nrows * ncols)) 
+		int(100 * float(2 * ourTree->leaves()) / (double(nrows) * ncols)) 
 		<< "% of the uncompressed image size." << endl;
+	cout << "MSE " << ourTree->mse() << ", PSNR " << ourTree->psnr()
+		<< " dB." << endl;
+
+	const char *wantSsim = getenv( "QT_SSIM" );
+	if ( wantSsim != NULL && *wantSsim != '\0' && strcmp( wantSsim, "0" ) != 0 )
+	{
+		STATS_START( decodeStart );
+		image2 = new byte [ size_t( nrows ) * ncols ];
+		ourTree->decode( ourTree->root, image2 );
+		STATS_PHASE( "decode", decodeStart );
+		cout << "SSIM " << ssim( image, image2, nrows, ncols,
+			max( 1u, thread::hardware_concurrency() ) ) << "." << endl;
+		delete [] image2;
+		image2 = NULL;
+	}
+
+	const char *wantSegment = getenv( "QT_SEGMENT" );
+	if ( wantSegment != NULL && *wantSegment != '\0' &&
+		strcmp( wantSegment, "0" ) != 0 )
+	{
+		vector<TreeRegion> regions;
+		vector<unsigned int> labels;
+		vector<byte> painted( size_t( nrows ) * ncols );
+		vector<byte> decoded( size_t( nrows ) * ncols );
+		char *plain = NULL, *segmented = NULL;
+		size_t plainLength = 0, segmentedLength = 0;
+		quadTree copy;
+		bool same = false;
+
+		ourTree->segment( fudge, regions, labels, painted.data() );
+		FILE *fout = open_memstream( &plain, &plainLength );
+		ourTree->save( fout );
+		fclose( fout );
+		fout = open_memstream( &segmented, &segmentedLength );
+		ourTree->saveSegmented( fout, fudge );
+		fclose( fout );
+
+		//Read the segmented tree back and compare it with the painted image
+		FILE *fin = fmemopen( segmented, segmentedLength, "rb" );
+		if ( fin != NULL && copy.setImage( image, nrows, ncols, fudge,
+			criterion ) && copy.loadSegmented( fin ) )
+		{
+			copy.decode( copy.root, decoded.data() );
+			same = decoded == painted;
+		}
+		if ( fin != NULL )
+			fclose( fin );
+
+		cout << regions.size() << " regions after joining adjacent leaves with"
+			" means within " << fudge << ": " << segmentedLength << " bytes"
+			" segmented, " << plainLength << " bytes as a plain tree ("
+			<< ( same ? "decodes the same" : "ERROR: does not read back" )
+			<< ")." << endl;
+		free( plain );
+		free( segmented );
+	}
 }
 
 /**************************************************************************//** 
@@ -211,18 +338,23 @@ void initOpenGL( const char *filename, int nrows, int ncols )
 	// 32-bit graphics and single buffering
     glutInitDisplayMode( GLUT_RGBA | GLUT_SINGLE );	        
 
-    ScreenWidth = 2 * ncols;
-    ScreenHeight = nrows;
-    glutInitWindowSize( ScreenWidth, ScreenHeight + 24 );	// initial window size
+    ScreenWidth = 2 * min( ncols, MaxPanel );
+    ScreenHeight = min( nrows, MaxPanel ) + TitleHeight;
+    glutInitWindowSize( ScreenWidth, ScreenHeight );	// initial window size
     glutInitWindowPosition( 100, 50 );			    // initial window  position
     glutCreateWindow( filename );			            // window title
 
     glClearColor( 0.0, 0.0, 0.0, 0.0 );   // use black for glClear command
+    glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );  // rows of any width
+    fitView();
 
     // callback routines
     glutDisplayFunc( display );				// how to redisplay window
     glutReshapeFunc( reshape );				// how to resize window
     glutKeyboardFunc( keyboard );			// how to handle key presses
+    glutSpecialFunc( special );				// how to handle arrow keys
+    glutMouseFunc( mouse );				// how to handle clicks and wheel
+    glutMotionFunc( motion );				// how to handle dragging
 }
 
 /******************************************************************************/
@@ -235,7 +367,10 @@ void initOpenGL( const char *filename, int nrows, int ncols )
  * @author Chris Hjelmfelt
  * 
  * @par Description: 
- * Callback function that tells OpenGL how to redraw window
+ * Callback function that tells OpenGL how to redraw window. Each half of
+ * the window shows the current view, the original image on the left and
+ * the quadtree drawn by quadTree::render on the right. The statistics are
+ * reported once the first frame, and so the first render, is done.
  *
  *****************************************************************************/
 void display( void )
@@ -243,21 +378,43 @@ void display( void )
 	const float color[3] = {1.0, 1.0, 1.0};
 	char original[20] = "Original Image";
 	char quad[40] = "Quadtree Image (spacebar toggles quads)";
+	static vector<byte> left, right;
+	static bool firstFrame = true;
+	int w = ScreenWidth / 2;
+	int h = ScreenHeight - TitleHeight;
+
     // clear the display
     glClear( GL_COLOR_BUFFER_BIT );
     
-
-    // display image in color and monochrome
-    //displayColor( 0, 0, ncols, nrows, BMPimage );
-    displayMonochrome( 0, 0, ncols, nrows, image );
-    displayMonochrome(ncols, 0, ncols, nrows, (overlay ? image3 : image2));
+    // display the view of the monochrome image and of the tree
+    if ( w > 0 && h > 0 )
+    {
+        left.assign( w * h, 0 );
+        right.assign( w * h, 0 );
+        rasterizeImage( left.data(), w, h );
+        STATS_START( renderStart );
+        ourTree->render( ourTree->root, right.data(), h, w, viewLeft,
+            viewBottom, zoom, overlay );
+        if ( firstFrame )
+        {
+            STATS_PHASE( "render", renderStart );
+        }
+        displayMonochrome( 0, 0, w, h, left.data() );
+        displayMonochrome( w, 0, w, h, right.data() );
+    }
     
     //Title bar to label the images
-    DrawTextString( original , 20, nrows + 5, color);
-    DrawTextString( quad, ncols + 20, nrows + 5, color);
+    DrawTextString( original , 20, h + 5, color);
+    DrawTextString( quad, w + 20, h + 5, color);
     
     // flush graphical output
     glFlush();
+
+    if ( firstFrame )
+    {
+        STATS_REPORT( cerr );
+        firstFrame = false;
+    }
 }
 
 /**************************************************************************//** 
@@ -305,8 +462,6 @@ void keyboard( unsigned char key, int x, int y )
             // Escape quits program
         case EscapeKey:
         	delete [] image;
-        	delete [] image2;
-        	delete [] image3;
         	ourTree->~quadTree();
             exit( 0 );
             break;
@@ -314,6 +469,19 @@ void keyboard( unsigned char key, int x, int y )
         	overlay = !overlay;
         	glutPostRedisplay();
 			break;
+        case '+': // Zoom in and out around the middle of the view
+        case '=':
+            zoomAt( 2, ScreenWidth / 4, TitleHeight +
+                ( ScreenHeight - TitleHeight ) / 2 );
+            break;
+        case '-':
+            zoomAt( 0.5, ScreenWidth / 4, TitleHeight +
+                ( ScreenHeight - TitleHeight ) / 2 );
+            break;
+        case '0': // Fit the image in the window again
+            fitView();
+            glutPostRedisplay();
+            break;
             // anything else redraws window
         default:
             glutPostRedisplay();
@@ -321,6 +489,181 @@ void keyboard( unsigned char key, int x, int y )
     }
 }
 
+/**************************************************************************//** 
+ * @par Description: 
+ * Callback function that tells OpenGL how to handle the arrow keys, which
+ * pan the view by an eighth of its size
+ * 
+ * @param[in]   key - key that was pressed
+ * @param[in]   x - x coordinate
+ * @param[in]   y - y coordinate
+ * 
+ *****************************************************************************/
+void special( int key, int x, int y )
+{
+    double stepX = ScreenWidth / 2 / 8 / zoom;
+    double stepY = ( ScreenHeight - TitleHeight ) / 8 / zoom;
+
+    switch ( key )
+    {
+        case GLUT_KEY_LEFT:
+            viewLeft -= stepX;
+            break;
+        case GLUT_KEY_RIGHT:
+            viewLeft += stepX;
+            break;
+        case GLUT_KEY_UP:
+            viewBottom += stepY;
+            break;
+        case GLUT_KEY_DOWN:
+            viewBottom -= stepY;
+            break;
+        default:
+            return;
+    }
+    glutPostRedisplay();
+}
+
+/**************************************************************************//** 
+ * @par Description: 
+ * Callback function that tells OpenGL how to handle mouse buttons. The
+ * wheel (buttons 3 and 4 in freeglut) zooms around the pointer and the left
+ * button starts a drag.
+ * 
+ * @param[in]   button - button that changed
+ * @param[in]   state - GLUT_DOWN or GLUT_UP
+ * @param[in]   x - x coordinate
+ * @param[in]   y - y coordinate
+ * 
+ *****************************************************************************/
+void mouse( int button, int state, int x, int y )
+{
+    if ( state != GLUT_DOWN )
+    {
+        if ( button == GLUT_LEFT_BUTTON )
+            dragging = false;
+        return;
+    }
+
+    if ( button == 3 )
+        zoomAt( 1.25, x, y );
+    else if ( button == 4 )
+        zoomAt( 0.8, x, y );
+    else if ( button == GLUT_LEFT_BUTTON )
+    {
+        dragging = true;
+        dragX = x;
+        dragY = y;
+    }
+}
+
+/**************************************************************************//** 
+ * @par Description: 
+ * Callback function that tells OpenGL how to handle the mouse moving with
+ * a button down. Dragging with the left button moves the image with the
+ * pointer.
+ * 
+ * @param[in]   x - x coordinate
+ * @param[in]   y - y coordinate
+ * 
+ *****************************************************************************/
+void motion( int x, int y )
+{
+    if ( !dragging )
+        return;
+
+    // window y grows downwards, image rows grow upwards
+    viewLeft -= ( x - dragX ) / zoom;
+    viewBottom += ( y - dragY ) / zoom;
+    dragX = x;
+    dragY = y;
+    glutPostRedisplay();
+}
+
+/**************************************************************************//** 
+ * @par Description: 
+ * Sets the view to show the whole image centered in each half of the
+ * window, at most one screen pixel per image pixel
+ * 
+ *****************************************************************************/
+void fitView( void )
+{
+    double w = ScreenWidth / 2;
+    double h = ScreenHeight - TitleHeight;
+
+    zoom = min( 1.0, min( w / ncols, h / nrows ) );
+    viewLeft = ( ncols - w / zoom ) / 2;
+    viewBottom = ( nrows - h / zoom ) / 2;
+}
+
+/**************************************************************************//** 
+ * @par Description: 
+ * Zooms the view, keeping the image point under a window position where it
+ * is. Zooming out stops once the image fills half of the view.
+ * 
+ * @param[in]   factor - how much to multiply the zoom by
+ * @param[in]   x - window x coordinate, in either half of the window
+ * @param[in]   y - window y coordinate, from the top of the window
+ * 
+ *****************************************************************************/
+void zoomAt( double factor, int x, int y )
+{
+    int w = ScreenWidth / 2;
+    int h = ScreenHeight - TitleHeight;
+    double minZoom = min( 1.0, min( double( w ) / ncols,
+        double( h ) / nrows ) ) / 2;
+    double px, py, newZoom;
+
+    if ( w <= 0 || h <= 0 )
+        return;
+
+    // position inside the half of the window, from its bottom left corner
+    px = x % w + 0.5;
+    py = ScreenHeight - y - 0.5;
+    newZoom = max( minZoom, min( MaxZoom, zoom * factor ) );
+
+    viewLeft += px / zoom - px / newZoom;
+    viewBottom += py / zoom - py / newZoom;
+    zoom = newZoom;
+    glutPostRedisplay();
+}
+
+/**************************************************************************//** 
+ * @par Description: 
+ * Draws the part of the monochrome image inside the view into a screen
+ * sized array, taking the image pixel under the center of each screen
+ * pixel. Screen pixels outside the image are left alone.
+ * 
+ * @param[out]  out - screen array of h x w, bottom row first
+ * @param[in]   w - width of the view in screen pixels
+ * @param[in]   h - height of the view in screen pixels
+ * 
+ *****************************************************************************/
+void rasterizeImage( byte *out, int w, int h )
+{
+    vector<int> cols( w );
+    byte *row;
+    int i, j, r;
+
+    for ( j = 0; j < w; j++ )
+    {
+        cols[j] = int( floor( viewLeft + ( j + 0.5 ) / zoom ) );
+        if ( cols[j] >= ncols )
+            cols[j] = -1;
+    }
+
+    for ( i = 0; i < h; i++ )
+    {
+        r = int( floor( viewBottom + ( i + 0.5 ) / zoom ) );
+        if ( r < 0 || r >= nrows )
+            continue;
+        row = image + size_t( r ) * ncols;
+        for ( j = 0; j < w; j++ )
+            if ( cols[j] >= 0 )
+                out[i * w + j] = row[cols[j]];
+    }
+}
+
 /**************************************************************************//** 
  * @author John M. Weiss, Ph.D.
  * 
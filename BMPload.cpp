@@ -10,9 +10,13 @@
 */
 
 #include <cstdio>
+#include <cstring>
 
 // prototypes
 bool LoadBmpFile( const char* filename, int &NumRows, int &NumCols, unsigned char* &ImagePtr );
+void ConvertToMonochrome( const unsigned char* RGBimage, int NumRows, int NumCols, unsigned char* GrayImage, unsigned long long* Hash = NULL );
+unsigned long long HashMonochrome( const unsigned char* GrayImage, int NumRows, int NumCols );
+static unsigned long long HashRow( const unsigned char* row, int length, unsigned long long hash );
 static short readShort( FILE* infile );
 static int readLong( FILE* infile );
 static void skipChars( FILE* infile, int numChars );
@@ -73,7 +77,7 @@ bool LoadBmpFile( const char* filename, int &NumRows, int &NumCols, unsigned cha
     }
 
     // allocate memory
-    ImagePtr = new unsigned char[ NumRows * GetNumBytesPerRow( NumCols ) ];
+    ImagePtr = new unsigned char[ size_t( NumRows ) * GetNumBytesPerRow( NumCols ) ];
     if ( !ImagePtr )
     {
         fclose ( infile );
@@ -115,6 +119,95 @@ bool LoadBmpFile( const char* filename, int &NumRows, int &NumCols, unsigned cha
     return true;
 }
 
+/**************************************************************************//** 
+ * @author John M. Weiss, Ph.D.
+ * 
+ * @par Description: 
+ * Converts a 24-bit color image read by LoadBmpFile to an 8-bit monochrome
+ * image using the usual luminance weights for red, green and blue.
+ * Optionally hashes the monochrome image while converting it, one row at a
+ * time while the row is still in the cache, so the hash costs next to nothing.
+ * 
+ * @param[in]       RGBimage - color image from LoadBmpFile
+ * @param[in]       NumRows - number of rows
+ * @param[in]       NumCols - number of columns
+ * @param[out]      GrayImage - NumRows x NumCols array to fill
+ * @param[out]      Hash - if not NULL, receives a 64-bit hash of the 
+ *                  dimensions and pixels of the monochrome image
+ * 
+ *****************************************************************************/
+void ConvertToMonochrome( const unsigned char* RGBimage, int NumRows, int NumCols, unsigned char* GrayImage, unsigned long long* Hash )
+{
+    unsigned long long hash = HashRow( NULL, 0, ( unsigned long long ) NumRows << 32 | NumCols );
+
+    for ( int row = 0; row < NumRows; row++ )
+    {
+        const unsigned char* RGBptr = RGBimage + size_t( row ) * GetNumBytesPerRow( NumCols );
+        for ( int col = 0; col < NumCols; col++ )
+        {
+            GrayImage[col] = 0.30 * RGBptr[0] + 0.59 * RGBptr[1] + 0.11 * RGBptr[2] + 0.5;
+            RGBptr += 3;
+        }
+        if ( Hash )
+            hash = HashRow( GrayImage, NumCols, hash );
+        GrayImage += NumCols;
+    }
+
+    if ( Hash )
+        *Hash = hash;
+}
+
+/**************************************************************************//** 
+ * @par Description: 
+ * Returns the hash ConvertToMonochrome computes, for a monochrome image
+ * that did not come from a color one.
+ * 
+ * @param[in]       GrayImage - NumRows x NumCols monochrome image
+ * @param[in]       NumRows - number of rows
+ * @param[in]       NumCols - number of columns
+ * 
+ * @returns 64-bit hash of the dimensions and pixels of the image
+ * 
+ *****************************************************************************/
+unsigned long long HashMonochrome( const unsigned char* GrayImage, int NumRows, int NumCols )
+{
+    unsigned long long hash = HashRow( NULL, 0, ( unsigned long long ) NumRows << 32 | NumCols );
+
+    for ( int row = 0; row < NumRows; row++ )
+        hash = HashRow( GrayImage + size_t( row ) * NumCols, NumCols, hash );
+    return hash;
+}
+
+/* ********************************************************************
+ *  @par HashRow fast non-cryptographic hash of a row of pixels
+ *
+ *  Folds 8 bytes at a time into the hash with a multiply and xor-shift
+ *  mix (as in MurmurHash3's finalizer), then the leftover bytes.
+ *
+ *  @param[in]       row - the pixels to hash
+ *  @param[in]       length - number of pixels in the row
+ *  @param[in]       hash - hash of everything before this row
+ *  @returns  	     the updated hash
+ **********************************************************************/
+static unsigned long long HashRow( const unsigned char* row, int length, unsigned long long hash )
+{
+    const unsigned long long mult = 0xff51afd7ed558ccdULL;
+    unsigned long long word;
+    int i = 0;
+
+    for ( ; i + 8 <= length; i += 8 )
+    {
+        memcpy( &word, row + i, 8 );
+        hash = ( hash ^ word ) * mult;
+        hash ^= hash >> 33;
+    }
+    for ( word = 0; i < length; i++ )
+        word = word << 8 | row[i];
+    hash = ( hash ^ word ^ length ) * mult;
+    hash ^= hash >> 33;
+    return hash;
+}
+
 /* ********************************************************************
  *  @par GetNumBytesPerRow rows are word aligned
  *  @author John M. Weiss, Ph.D.
@@ -0,0 +1,568 @@
+/*************************************************************************//**
+ * @file
+ *
+ * @brief Benchmark for quadtree encoding and decoding
+ *
+ * @details Runs every stage of the program except the display: LoadBmpFile,
+ * the conversion to monochrome, fillTree, decode and deleting the tree. The
+ * stages are timed over a corpus of synthetic images (flat, gradient and
+ * noise) at several sizes plus the photos in the directory (lena.bmp and
+ * Bird.bmp), each at several fudge factors. Synthetic images are written as
+ * BMP files first so LoadBmpFile is timed on them as well. 512 x 512 images
+ * are also run with the fixed size quadTree512.
+ *
+ * Every case is run several times and the fastest run is kept. Results are
+ * written as JSON, one case per line, with the time of every stage in
+ * nanoseconds per pixel, the nodes built per second and the peak resident
+ * set size. Every case runs in a child process of its own so the peak
+ * belongs to that case alone and not to the largest case run before it.
+ *
+ * The program exits with status 1 if the child running any case crashed.
+ * Given a baseline file written by an earlier run, every case is compared
+ * against the baseline and the program also exits with status 1 if the
+ * total time per pixel of any case grew by more than the allowed
+ * percentage, or if a case in the baseline did not run. Cases missing from
+ * the baseline are listed but do not fail the run, so new cases can be
+ * added.
+ *
+ * @par Usage:
+   @verbatim
+   ./quadTreeBench [-o results.json] [-b baseline.json] [-t percent] [-r reps]
+
+   -o   write the results to a file instead of standard output
+   -b   compare against a baseline written by an earlier run
+   -t   slowdown allowed before a case is a regression (default 10)
+   -r   number of runs of every case, the fastest is kept (default 5)
+   @endverbatim
+ *
+ *****************************************************************************/
+
+//Includes
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "quadTree.h"
+#include "globals.h"
+
+using namespace std;
+using namespace std::chrono;
+
+// function prototypes
+bool LoadBmpFile( const char* filename, int &nrows, int &ncols, byte* &image );
+void ConvertToMonochrome( const byte* BMPimage, int nrows, int ncols, byte* image, unsigned long long* hash = NULL );
+
+///One image of the benchmark corpus
+struct BenchImage
+{
+	///Name used in the results, e.g. gradient-512
+	string name;
+
+	///BMP file the image is loaded from
+	string filename;
+
+	///True if the file was written by the benchmark and must be removed
+	bool temporary;
+};
+
+///How running a case ended, see forkCase
+enum CaseStatus
+{
+	///The case ran and has results
+	CASE_DONE,
+
+	///The image could not be loaded or does not fit the tree
+	CASE_SKIPPED,
+
+	///The process running the case crashed or could not be started
+	CASE_FAILED
+};
+
+///Times and counts for one case of the benchmark
+struct BenchResult
+{
+	///Name of the case, image name and fudge factor
+	string name;
+
+	///Nanoseconds per pixel for each stage of the fastest run
+	double load, convert, build, decode, teardown;
+
+	///Nodes and leaves in the tree
+	unsigned int nodes, leaves;
+
+	///Peak resident set size of the process that ran the case in kilobytes
+	long peakRss;
+};
+
+/**************************************************************************//**
+ * @par Description:
+ * Writes an 8-bit monochrome image as a 24-bit BMP file so it can be read
+ * back with LoadBmpFile
+ *
+ * @param[in]   filename - the file to write
+ * @param[in]   rows - number of rows
+ * @param[in]   cols - number of columns
+ * @param[in]   pixels - rows x cols monochrome pixels, bottom row first
+ *
+ * @returns true if the file was written, false otherwise
+ *
+ *****************************************************************************/
+bool writeBmpFile( const char* filename, int rows, int cols, const byte* pixels )
+{
+	//Rows of a BMP file are padded to a multiple of 4 bytes
+	int rowBytes = ( ( 3 * cols + 3 ) >> 2 ) << 2;
+	int dataBytes = rowBytes * rows;
+	unsigned char header[54] = { 'B', 'M' };
+	int fields[] = { 54 + dataBytes, 0, 54, 40, cols, rows };
+	int i, j;
+
+	FILE* outfile = fopen( filename, "wb" );
+	if ( !outfile )
+		return false;
+
+	//File size, reserved, data offset, header size, width and height
+	for ( i = 0; i < 6; i++ )
+		for ( j = 0; j < 4; j++ )
+			header[2 + 4 * i + j] = ( fields[i] >> ( 8 * j ) ) & 0xff;
+	header[26] = 1;		// one color plane
+	header[28] = 24;	// 24 bits per pixel
+	fwrite( header, 1, 54, outfile );
+
+	vector<unsigned char> line( rowBytes, 0 );
+	for ( i = 0; i < rows; i++ )
+	{
+		for ( j = 0; j < cols; j++ )
+			line[3 * j] = line[3 * j + 1] = line[3 * j + 2] = pixels[i * cols + j];
+		fwrite( line.data(), 1, rowBytes, outfile );
+	}
+
+	return fclose( outfile ) == 0;
+}
+
+/**************************************************************************//**
+ * @par Description:
+ * Fills an image with one of the synthetic patterns of the corpus
+ *   flat     - every pixel the same value
+ *   gradient - values rising smoothly from one corner to the other
+ *   noise    - pseudo random values from a fixed seed
+ *
+ * @param[in]   pattern - flat, gradient or noise
+ * @param[in]   size - number of rows and columns
+ * @param[out]  pixels - size x size array to fill
+ *
+ *****************************************************************************/
+void makePattern( const string &pattern, int size, byte* pixels )
+{
+	unsigned int seed = 12345;
+	int i, j;
+
+	for ( i = 0; i < size; i++ )
+	{
+		for ( j = 0; j < size; j++ )
+		{
+			if ( pattern == "flat" )
+				pixels[i * size + j] = 128;
+			else if ( pattern == "gradient" )
+				pixels[i * size + j] = 255 * ( i + j ) / ( 2 * size - 2 );
+			else
+			{
+				seed = seed * 1103515245 + 12345;
+				pixels[i * size + j] = seed >> 24;
+			}
+		}
+	}
+}
+
+/**************************************************************************//**
+ * @par Description:
+ * Runs one case of the benchmark: loads the image, converts it, builds the
+ * tree, decodes it and deletes it, reps times. Keeps the fastest time of
+ * every stage. Every run builds a new tree, so no run reuses nodes from the
+ * tree's free list, and the teardown stage destroys the tree so the nodes
+ * are really freed. Tree is the quadtree type to encode with, so the fixed
+ * size trees can be compared with quadTree.
+ *
+ * @param[in]   img - the image to run
+ * @param[in]   factor - the fudge factor to build the tree with
+ * @param[in]   reps - number of runs
+ * @param[in]   variant - added to the case name to tell tree types apart
+ * @param[out]  result - times and counts of the case
+ *
+ * @returns true if the image could be loaded and fits the tree
+ *
+ *****************************************************************************/
+template <typename Tree>
+bool runCase( const BenchImage &img, int factor, int reps, const string &variant,
+	BenchResult &result )
+{
+	Tree *tree;
+	double best[5];
+	double pixels;
+	int run, stage;
+	bool fits;
+
+	fudge = factor;
+	result.name = img.name + variant + "-f" + to_string( factor );
+	for ( stage = 0; stage < 5; stage++ )
+		best[stage] = 1e30;
+
+	for ( run = 0; run < reps; run++ )
+	{
+		steady_clock::time_point t[6];
+
+		t[0] = steady_clock::now();
+		if ( !LoadBmpFile( img.filename.c_str(), nrows, ncols, BMPimage ) )
+			return false;
+		t[1] = steady_clock::now();
+
+		image = new byte [nrows * ncols];
+		image2 = new byte [nrows * ncols];
+		ConvertToMonochrome( BMPimage, nrows, ncols, image );
+		t[2] = steady_clock::now();
+
+		tree = new Tree;
+		fits = tree->setImage( image, nrows, ncols, fudge, criterion );
+		if ( fits )
+			tree->fillTree( tree->root, 0, 0, nrows );
+		t[3] = steady_clock::now();
+
+		tree->decode( tree->root, image2 );
+		t[4] = steady_clock::now();
+
+		result.nodes = tree->nodes();
+		result.leaves = tree->leaves();
+		delete tree;
+		t[5] = steady_clock::now();
+
+		for ( stage = 0; stage < 5; stage++ )
+			best[stage] = min( best[stage],
+				duration<double, nano>( t[stage + 1] - t[stage] ).count() );
+
+		delete [] BMPimage;
+		delete [] image;
+		delete [] image2;
+		BMPimage = image = image2 = NULL;
+		if ( !fits )
+			return false;
+	}
+
+	pixels = double( nrows ) * ncols;
+	result.load = best[0] / pixels;
+	result.convert = best[1] / pixels;
+	result.build = best[2] / pixels;
+	result.decode = best[3] / pixels;
+	result.teardown = best[4] / pixels;
+	return true;
+}
+
+/**************************************************************************//**
+ * @par Description:
+ * Runs one case of the benchmark with runCase in a child process and reads
+ * back its results, so the peak resident set size reported for the case is
+ * that of the child alone. Sets nrows and ncols to the size of the image.
+ * A child that dies from a signal or exits with an error is reported on
+ * standard error.
+ *
+ * @param[in]   img - the image to run
+ * @param[in]   factor - the fudge factor to build the tree with
+ * @param[in]   reps - number of runs
+ * @param[in]   variant - added to the case name to tell tree types apart
+ * @param[out]  result - times and counts of the case
+ *
+ * @returns CASE_DONE, CASE_SKIPPED if the image could not be loaded or
+ *          does not fit the tree, CASE_FAILED if the child crashed
+ *
+ *****************************************************************************/
+template <typename Tree>
+CaseStatus forkCase( const BenchImage &img, int factor, int reps,
+	const string &variant, BenchResult &result )
+{
+	//Everything runCase finds out, sent back through a pipe
+	struct
+	{
+		bool ok;
+		double load, convert, build, decode, teardown;
+		unsigned int nodes, leaves;
+		int rows, cols;
+	} reply;
+	struct rusage usage;
+	int fds[2];
+	int status;
+	pid_t pid;
+
+	memset( &reply, 0, sizeof( reply ) );
+	result.name = img.name + variant + "-f" + to_string( factor );
+	if ( pipe( fds ) != 0 || ( pid = fork() ) < 0 )
+	{
+		perror( "Error: unable to start a case" );
+		return CASE_FAILED;
+	}
+
+	if ( pid == 0 )
+	{
+		close( fds[0] );
+		reply.ok = runCase<Tree>( img, factor, reps, variant, result );
+		reply.load = result.load;
+		reply.convert = result.convert;
+		reply.build = result.build;
+		reply.decode = result.decode;
+		reply.teardown = result.teardown;
+		reply.nodes = result.nodes;
+		reply.leaves = result.leaves;
+		reply.rows = nrows;
+		reply.cols = ncols;
+		_exit( write( fds[1], &reply, sizeof( reply ) ) == sizeof( reply ) ?
+			0 : 1 );
+	}
+
+	close( fds[1] );
+	if ( read( fds[0], &reply, sizeof( reply ) ) != sizeof( reply ) )
+		reply.ok = false;
+	close( fds[0] );
+	if ( wait4( pid, &status, 0, &usage ) != pid )
+	{
+		perror( "Error: lost the process running a case" );
+		return CASE_FAILED;
+	}
+	if ( WIFSIGNALED( status ) )
+	{
+		cerr << "Error: case " << result.name << " crashed: "
+			<< strsignal( WTERMSIG( status ) ) << endl;
+		return CASE_FAILED;
+	}
+	if ( WEXITSTATUS( status ) != 0 )
+	{
+		cerr << "Error: case " << result.name << " exited with status "
+			<< WEXITSTATUS( status ) << endl;
+		return CASE_FAILED;
+	}
+
+	result.load = reply.load;
+	result.convert = reply.convert;
+	result.build = reply.build;
+	result.decode = reply.decode;
+	result.teardown = reply.teardown;
+	result.nodes = reply.nodes;
+	result.leaves = reply.leaves;
+	result.peakRss = usage.ru_maxrss;
+	nrows = reply.rows;
+	ncols = reply.cols;
+	return reply.ok ? CASE_DONE : CASE_SKIPPED;
+}
+
+/**************************************************************************//**
+ * @par Description:
+ * Reads the total nanoseconds per pixel of every case from a results file
+ * written by an earlier run. Relies on the one case per line layout.
+ *
+ * @param[in]   filename - the baseline results file
+ * @param[out]  totals - total nanoseconds per pixel keyed by case name
+ *
+ * @returns true if the file could be read, false otherwise
+ *
+ *****************************************************************************/
+bool readBaseline( const char* filename, map<string, double> &totals )
+{
+	ifstream fin( filename );
+	string line;
+	size_t start, end;
+
+	if ( !fin )
+		return false;
+
+	while ( getline( fin, line ) )
+	{
+		start = line.find( "\"name\": \"" );
+		end = line.find( "\"total_ns_per_pixel\": " );
+		if ( start == string::npos || end == string::npos )
+			continue;
+		start += strlen( "\"name\": \"" );
+		totals[line.substr( start, line.find( '"', start ) - start )] =
+			atof( line.c_str() + end + strlen( "\"total_ns_per_pixel\": " ) );
+	}
+	return true;
+}
+
+/**************************************************************************//**
+ * @par Description:
+ * Parses the options, builds the corpus, runs every case, writes the results
+ * and compares them against the baseline if one was given.
+ *
+ * @param[in]	argc - number of arguments
+ * @param[in]	*argv[] - options, see the usage in the file header
+ *
+ * @returns 0 if every case ran with no regressions and every baseline case
+ *          ran, 1 otherwise.
+ *
+ *****************************************************************************/
+int main( int argc, char *argv[] )
+{
+	const char* outName = NULL;
+	const char* baseName = NULL;
+	double tolerance = 10;
+	int reps = 5;
+	int sizes[] = { 256, 512, 1024, 2048 };
+	int factors[] = { 0, 8, 32 };
+	const char* patterns[] = { "flat", "gradient", "noise" };
+	const char* photos[] = { "lena.bmp", "Bird.bmp" };
+	vector<BenchImage> corpus;
+	vector<BenchResult> results;
+	map<string, double> baseline;
+	map<string, bool> seen;
+	int regressions = 0;
+	int failures = 0;
+	int notRun = 0;
+	int newCases = 0;
+	int opt;
+
+	while ( ( opt = getopt( argc, argv, "o:b:t:r:" ) ) != -1 )
+	{
+		switch ( opt )
+		{
+			case 'o': outName = optarg; break;
+			case 'b': baseName = optarg; break;
+			case 't': tolerance = atof( optarg ); break;
+			case 'r': reps = max( 1, atoi( optarg ) ); break;
+			default:
+				cerr << "Usage: quadTreeBench [-o results.json] [-b baseline.json]"
+					" [-t percent] [-r reps]\n";
+				return 1;
+		}
+	}
+
+	if ( baseName && !readBaseline( baseName, baseline ) )
+	{
+		cerr << "Error: unable to read baseline " << baseName << endl;
+		return 1;
+	}
+
+	//Write the synthetic images, smallest first
+	for ( int size : sizes )
+	{
+		vector<byte> pixels( size * size );
+		for ( const char* pattern : patterns )
+		{
+			BenchImage img;
+			img.name = string( pattern ) + "-" + to_string( size );
+			img.filename = "/tmp/quadTreeBench-" + to_string( getpid() ) + "-" +
+				img.name + ".bmp";
+			img.temporary = true;
+			makePattern( pattern, size, pixels.data() );
+			if ( !writeBmpFile( img.filename.c_str(), size, size, pixels.data() ) )
+			{
+				cerr << "Error: unable to write " << img.filename << endl;
+				return 1;
+			}
+			corpus.push_back( img );
+		}
+	}
+
+	//Photos are used when they are in the current directory
+	for ( const char* photo : photos )
+	{
+		if ( access( photo, R_OK ) != 0 )
+			continue;
+		BenchImage img;
+		img.name = string( photo ).substr( 0, strlen( photo ) - 4 );
+		img.filename = photo;
+		img.temporary = false;
+		corpus.push_back( img );
+	}
+
+	ofstream fout;
+	if ( outName )
+		fout.open( outName );
+	ostream &out = outName ? fout : cout;
+
+	out << "{\n  \"benchmark\": \"quadTree\",\n  \"reps\": " << reps
+		<< ",\n  \"cases\": [\n";
+	for ( const BenchImage &img : corpus )
+	{
+		for ( int factor : factors )
+		{
+			//512 x 512 images are run again with the fixed size tree
+			for ( int fixed = 0; fixed < 2; fixed++ )
+			{
+				BenchResult r;
+				CaseStatus status = fixed == 0 ?
+					forkCase<quadTree>( img, factor, reps, "", r ) :
+					forkCase<quadTree512>( img, factor, reps, "-fixed512", r );
+				if ( status == CASE_FAILED )
+				{
+					failures++;
+					continue;
+				}
+				if ( status == CASE_SKIPPED )
+				{
+					//Only the plain tree must take every image
+					if ( fixed == 0 )
+						cerr << "Error: unable to load " << img.filename << endl;
+					break;
+				}
+
+				double total = r.load + r.convert + r.build + r.decode + r.teardown;
+				double nodesPerSec = r.nodes / ( r.build * nrows * ncols * 1e-9 );
+				ostringstream line;
+				line << "    {\"name\": \"" << r.name << "\", \"rows\": " << nrows
+					<< ", \"cols\": " << ncols << ", \"fudge\": " << factor
+					<< ", \"nodes\": " << r.nodes << ", \"leaves\": " << r.leaves
+					<< ", \"load_ns_per_pixel\": " << r.load
+					<< ", \"convert_ns_per_pixel\": " << r.convert
+					<< ", \"build_ns_per_pixel\": " << r.build
+					<< ", \"decode_ns_per_pixel\": " << r.decode
+					<< ", \"teardown_ns_per_pixel\": " << r.teardown
+					<< ", \"total_ns_per_pixel\": " << total
+					<< ", \"nodes_per_sec\": " << nodesPerSec
+					<< ", \"peak_rss_kb\": " << r.peakRss << "}";
+				out << ( results.empty() ? "" : ",\n" ) << line.str();
+				results.push_back( r );
+
+				//Compare against the baseline
+				seen[r.name] = true;
+				if ( baseName && !baseline.count( r.name ) )
+				{
+					cerr << "Not in baseline: " << r.name << endl;
+					newCases++;
+				}
+				else if ( baseName &&
+					total > baseline[r.name] * ( 1 + tolerance / 100 ) )
+				{
+					cerr << "Regression: " << r.name << " " << total
+						<< " ns/pixel, baseline " << baseline[r.name] << endl;
+					regressions++;
+				}
+			}
+		}
+
+		if ( img.temporary )
+			remove( img.filename.c_str() );
+	}
+	out << "\n  ]\n}\n";
+
+	if ( baseName )
+	{
+		for ( const auto &base : baseline )
+		{
+			if ( !seen.count( base.first ) )
+			{
+				cerr << "Not run: " << base.first << endl;
+				notRun++;
+			}
+		}
+		cerr << regressions << " regressions, " << notRun
+			<< " baseline cases not run and " << newCases
+			<< " cases not in baseline against " << baseName << endl;
+	}
+	if ( failures > 0 )
+		cerr << failures << " cases crashed" << endl;
+	return regressions > 0 || notRun > 0 || failures > 0 ? 1 : 0;
+}
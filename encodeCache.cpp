@@ -0,0 +1,223 @@
+/**************************************************************************//**
+ * @file
+ * @brief The implementation of the encodeCache class
+ *****************************************************************************/
+
+//Include statements
+#include "encodeCache.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+using namespace std;
+
+///Tag at the start of every entry file
+static const char entryTag[4] = {'Q', 'T', 'C', '1'};
+
+///Numbers the temporary files written by this process
+static atomic<unsigned int> tempCount(0);
+
+///Temporary files older than this many seconds were left by a crash
+static const int staleSeconds = 3600;
+
+ /**************************************************************************//**
+ * @par Description:
+ * Constructor, reads the cache directory from $QT_CACHE_DIR and the size
+ * limit in megabytes from $QT_CACHE_MB, and creates the directory if it
+ * does not exist. The cache stays off if the directory cannot be created.
+ *
+ *****************************************************************************/
+encodeCache::encodeCache()
+{
+	const char *path = getenv("QT_CACHE_DIR");
+	const char *size = getenv("QT_CACHE_MB");
+
+	maxBytes = (size ? strtoull(size, NULL, 10) : 256) << 20;
+	if (path == NULL || *path == '\0')
+		return;
+	if (mkdir(path, 0777) != 0 && errno != EEXIST)
+		return;
+	dir = path;
+}
+
+ /**************************************************************************//**
+ * @par Description:
+ * Returns true if the cache has a directory to work in
+ *
+ * @returns true if the cache is on
+ *
+ *****************************************************************************/
+bool encodeCache::enabled()
+{
+	return !dir.empty();
+}
+
+ /**************************************************************************//**
+ * @par Description:
+ * Returns the file name of the entry for a key
+ *
+ * @param[in]      hash - hash of the monochrome image
+ * @param[in]      factor - the fudge factor
+ * @param[in]      crit - the split criterion
+ *
+ * @returns path of the entry file
+ *
+ *****************************************************************************/
+string encodeCache::entryName(unsigned long long hash, int factor,
+	SplitCriterion crit)
+{
+	char name[64];
+
+	snprintf(name, sizeof(name), "/%016llx-%d-%d.qtc", hash, factor,
+		(int) crit);
+	return dir + name;
+}
+
+ /**************************************************************************//**
+ * @par Description:
+ * Loads the tree stored for a key into tree. The key stored in the entry
+ * is checked as well as the file name. A hit updates the entry's
+ * modification time, which is what eviction uses as the time of last use.
+ *
+ * @param[in]      hash - hash of the monochrome image
+ * @param[in]      factor - the fudge factor
+ * @param[in]      crit - the split criterion
+ * @param[in,out]  tree - the tree to load into
+ *
+ * @returns true on a hit, false on a miss
+ *
+ *****************************************************************************/
+bool encodeCache::lookup(unsigned long long hash, int factor,
+	SplitCriterion crit, quadTree &tree)
+{
+	string name = entryName(hash, factor, crit);
+	FILE *fin;
+	char tag[4];
+	unsigned long long storedHash;
+	int key[2];
+	bool hit;
+
+	if (!enabled() || (fin = fopen(name.c_str(), "rb")) == NULL)
+		return false;
+
+	hit = fread(tag, 1, 4, fin) == 4 && memcmp(tag, entryTag, 4) == 0 &&
+		fread(&storedHash, sizeof(storedHash), 1, fin) == 1 &&
+		fread(key, sizeof(int), 2, fin) == 2 && storedHash == hash &&
+		key[0] == factor && key[1] == crit && tree.load(fin);
+	fclose(fin);
+
+	//Mark the entry as used just now
+	if (hit)
+		utimes(name.c_str(), NULL);
+	return hit;
+}
+
+ /**************************************************************************//**
+ * @par Description:
+ * Stores the tree for a key. The entry is written to a temporary file that
+ * is renamed over the entry file, so other processes see either the whole
+ * entry or none of it. Evicts old entries afterwards if the cache has grown
+ * past its size limit.
+ *
+ * @param[in]      hash - hash of the monochrome image
+ * @param[in]      factor - the fudge factor
+ * @param[in]      crit - the split criterion
+ * @param[in]      tree - the tree to store
+ *
+ * @returns true if the entry was stored, false otherwise
+ *
+ *****************************************************************************/
+bool encodeCache::store(unsigned long long hash, int factor,
+	SplitCriterion crit, quadTree &tree)
+{
+	string name = entryName(hash, factor, crit);
+	string temp = dir + "/tmp-" + to_string(getpid()) + "-" +
+		to_string(tempCount++);
+	int key[2] = {factor, crit};
+	FILE *fout = fopen(temp.c_str(), "wb");
+	bool ok;
+
+	if (fout == NULL)
+		return false;
+	ok = fwrite(entryTag, 1, 4, fout) == 4 &&
+		fwrite(&hash, sizeof(hash), 1, fout) == 1 &&
+		fwrite(key, sizeof(int), 2, fout) == 2 && tree.save(fout);
+	ok = fclose(fout) == 0 && ok;
+
+	if (!ok || rename(temp.c_str(), name.c_str()) != 0)
+	{
+		remove(temp.c_str());
+		return false;
+	}
+
+	evict();
+	return true;
+}
+
+ /**************************************************************************//**
+ * @par Description:
+ * Removes the least recently used entries until the total size of the
+ * entries is no more than maxBytes. Temporary files left behind by crashed
+ * processes are removed too. Holds an exclusive lock on the lock file of
+ * the directory so only one process evicts at a time.
+ *
+ *****************************************************************************/
+void encodeCache::evict()
+{
+	string lockName = dir + "/lock";
+	int lock = open(lockName.c_str(), O_RDWR | O_CREAT, 0666);
+	vector< pair<time_t, pair<off_t, string> > > entries;
+	unsigned long long total = 0;
+	struct dirent *ent;
+	struct stat info;
+	string path;
+	unsigned int i;
+	DIR *dp;
+
+	if (lock < 0)
+		return;
+	if (flock(lock, LOCK_EX) != 0 || (dp = opendir(dir.c_str())) == NULL)
+	{
+		close(lock);
+		return;
+	}
+
+	while ((ent = readdir(dp)) != NULL)
+	{
+		path = dir + "/" + ent->d_name;
+		if (stat(path.c_str(), &info) != 0 || !S_ISREG(info.st_mode))
+			continue;
+
+		if (strncmp(ent->d_name, "tmp-", 4) == 0 &&
+			time(NULL) - info.st_mtime > staleSeconds)
+			remove(path.c_str());
+		else if (strstr(ent->d_name, ".qtc") != NULL)
+		{
+			entries.push_back(make_pair(info.st_mtime,
+				make_pair(info.st_size, path)));
+			total += info.st_size;
+		}
+	}
+	closedir(dp);
+
+	//Oldest entries first
+	sort(entries.begin(), entries.end());
+	for (i = 0; i < entries.size() && total > maxBytes; i++)
+	{
+		if (remove(entries[i].second.second.c_str()) == 0)
+			total -= entries[i].second.first;
+	}
+
+	flock(lock, LOCK_UN);
+	close(lock);
+}
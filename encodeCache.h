@@ -0,0 +1,59 @@
+/**
+ *  @file
+ *  @brief The encodeCache class keeps encoded quadtrees on disk so the same
+ *  image encoded with the same fudge factor and split criterion is only
+ *  built once.
+ *
+ *  Entries are keyed by the hash of the monochrome image computed by
+ *  ConvertToMonochrome, the fudge factor and the criterion. Each entry is a
+ *  file in the cache directory holding the key and the tree written by
+ *  quadTree::save. The directory is $QT_CACHE_DIR, the cache is off when it
+ *  is not set. Its size is limited to $QT_CACHE_MB megabytes (default 256),
+ *  the least recently used entries are removed first.
+ *
+ *  Several processes may share the directory. Entries are written to a
+ *  temporary file and renamed into place, so a reader never sees a partial
+ *  entry, and eviction holds an exclusive lock on the directory's lock file.
+ *
+ *  @class encodeCache
+ */
+
+#ifndef _encode_Cache_
+#define _encode_Cache_
+
+#include <string>
+#include "quadTree.h"
+
+//encodeCache class interface
+class encodeCache
+{
+	private:
+		///Directory holding the entries, empty when the cache is off
+		std::string dir;
+
+		///Largest total size of the entries in bytes
+		unsigned long long maxBytes;
+
+		///Returns the file name of the entry for a key
+		std::string entryName(unsigned long long hash, int factor,
+			SplitCriterion crit);
+
+		///Removes the least recently used entries until under maxBytes
+		void evict();
+	public:
+		///Constructor, reads the directory and size from the environment
+		encodeCache();
+
+		///Returns true if the cache has a directory to work in
+		bool enabled();
+
+		///Loads the tree stored for a key, returns false on a miss
+		bool lookup(unsigned long long hash, int factor, SplitCriterion crit,
+			quadTree &tree);
+
+		///Stores the tree for a key
+		bool store(unsigned long long hash, int factor, SplitCriterion crit,
+			quadTree &tree);
+};
+
+#endif
@@ -0,0 +1,746 @@
+/*************************************************************************//**
+ * @file
+ *
+ * @brief Long running quadtree encoder listening on a Unix domain socket,
+ * and a client to send it images
+ *
+ * @details Running quadTree for every encode pays for process startup,
+ * linking GLUT and OpenGL and cold caches every time. The server starts
+ * once and keeps a pool of worker threads, each with its own quadTree whose
+ * nodes and tables are reused from one request to the next, so a request
+ * only costs the encode itself. With $QT_CACHE_DIR set, trees are kept in
+ * the same on-disk cache the viewer uses (encodeCache), so an image encoded
+ * again with the same fudge factor and criterion is not rebuilt.
+ *
+ * The acceptor thread queues every connection it accepts and wakes one
+ * idle worker for it, so a burst of requests is spread over all the
+ * workers. Only when every other worker is busy does a worker take a batch
+ * of queued connections in one trip through the queue, and it hands back
+ * the ones it has not started as soon as another worker goes idle, so
+ * batching never leaves a request waiting behind another while a worker
+ * sits idle. A client that stops sending is dropped after the read timeout
+ * instead of holding its worker. Each connection carries one request:
+ *
+ *   EncodeRequest, then the path of a 24-bit BMP file or rows x cols
+ *   monochrome pixels (bottom row first)
+ *
+ * and gets one reply:
+ *
+ *   EncodeReply, then the tree as written by quadTree::save
+ *
+ * Both sides run on the same machine, so the headers are sent in the
+ * machine's own byte order.
+ *
+ * The client can also write the tree in the flat layout of flatTree, look
+ * up pixels in such a file straight from the mapped pages, and list the
+ * rectangles where two saved trees differ (quadTree::diff).
+ *
+ * @par Usage:
+   @verbatim
+   ./quadTreeServer serve [-s socket] [-w workers] [-b batch] [-t seconds]
+   ./quadTreeServer encode [-s socket] [-o tree.qtr] [-f tree.qtf] image.bmp fudge [criterion]
+   ./quadTreeServer lookup tree.qtf row col [row col ...]
+   ./quadTreeServer diff old.qtr new.qtr
+
+   -s   socket path (default $QT_SOCKET or /tmp/quadTree.sock)
+   -w   number of worker threads (default number of cores)
+   -b   most connections a worker takes at once while the others are busy
+        (default 8)
+   -t   seconds to wait for a request before dropping it (default 5)
+   -o   file to write the tree returned by the server to
+   -f   file to write the tree to in the flat layout
+   @endverbatim
+ *
+ *****************************************************************************/
+
+//Includes
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <climits>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <malloc.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "quadTree.h"
+#include "flatTree.h"
+#include "encodeCache.h"
+#include "globals.h"
+
+using namespace std;
+
+// function prototypes
+bool LoadBmpFile( const char* filename, int &nrows, int &ncols, byte* &image );
+void ConvertToMonochrome( const byte* BMPimage, int nrows, int ncols, byte* image, unsigned long long* hash = NULL );
+unsigned long long HashMonochrome( const byte* image, int nrows, int ncols );
+
+///Request kinds
+enum RequestKind
+{
+	///The payload is the path of a BMP file readable by the server
+	REQUEST_PATH,
+
+	///The payload is rows x cols monochrome pixels
+	REQUEST_PIXELS
+};
+
+///Header of a request sent to the server
+struct EncodeRequest
+{
+	///Always "QTQ1"
+	char tag[4];
+
+	///One of RequestKind
+	int kind;
+
+	///Image dimensions, ignored for REQUEST_PATH
+	int rows;
+	int cols;
+
+	///Quality factor and split criterion to encode with
+	int fudge;
+	int criterion;
+
+	///Bytes of payload following the header
+	unsigned int length;
+};
+
+///Header of the reply sent back by the server
+struct EncodeReply
+{
+	///Always "QTA1"
+	char tag[4];
+
+	///0 on success, otherwise the tree is left out
+	int status;
+
+	///Image dimensions
+	int rows;
+	int cols;
+
+	///Nodes and leaves in the tree
+	unsigned int nodes;
+	unsigned int leaves;
+
+	///Milliseconds the server spent loading and encoding the image
+	double encodeMs;
+
+	///Bytes of tree following the header
+	unsigned int length;
+};
+
+///Largest payload the server accepts, in bytes
+const unsigned int maxPayload = 1u << 30;
+
+///Released nodes a worker keeps between requests, enough for any tree of a
+///512 x 512 image; the rest of a larger tree is freed, see quadTree::trim
+const unsigned int keepNodes = 1u << 19;
+
+///Connections accepted and waiting for a worker
+static deque<int> pending;
+
+///Guards pending
+static mutex pendingLock;
+
+///Signals the workers that pending is not empty
+static condition_variable pendingReady;
+
+///Workers waiting for a connection, guarded by pendingLock
+static int idleWorkers = 0;
+
+/**************************************************************************//**
+ * @par Description:
+ * Reads exactly length bytes from a socket
+ *
+ * @param[in]   fd - the socket
+ * @param[out]  buffer - where to put the bytes
+ * @param[in]   length - number of bytes to read
+ *
+ * @returns true if all bytes were read, false on error or end of file
+ *
+ *****************************************************************************/
+bool readAll( int fd, void *buffer, size_t length )
+{
+	char *ptr = (char *) buffer;
+	ssize_t got;
+
+	while ( length > 0 )
+	{
+		got = read( fd, ptr, length );
+		if ( got <= 0 )
+			return false;
+		ptr += got;
+		length -= got;
+	}
+	return true;
+}
+
+/**************************************************************************//**
+ * @par Description:
+ * Writes exactly length bytes to a socket
+ *
+ * @param[in]   fd - the socket
+ * @param[in]   buffer - the bytes to write
+ * @param[in]   length - number of bytes to write
+ *
+ * @returns true if all bytes were written, false on error
+ *
+ *****************************************************************************/
+bool writeAll( int fd, const void *buffer, size_t length )
+{
+	const char *ptr = (const char *) buffer;
+	ssize_t put;
+
+	while ( length > 0 )
+	{
+		put = write( fd, ptr, length );
+		if ( put <= 0 )
+			return false;
+		ptr += put;
+		length -= put;
+	}
+	return true;
+}
+
+/**************************************************************************//**
+ * @par Description:
+ * Handles the one request on a connection: reads it, loads the image,
+ * encodes it with the worker's tree and writes back the reply. The tree is
+ * taken from the encode cache when it has one for the image, fudge factor
+ * and criterion, and stored there after it is built otherwise.
+ *
+ * @param[in]       fd - the connection
+ * @param[in,out]   tree - the worker's tree, reused between requests
+ * @param[in,out]   gray - the worker's monochrome image buffer
+ * @param[in]       cache - the encode cache, see encodeCache
+ *
+ *****************************************************************************/
+void serveRequest( int fd, quadTree &tree, vector<byte> &gray,
+	encodeCache &cache )
+{
+	EncodeRequest request;
+	EncodeReply reply;
+	SplitCriterion crit;
+	byte *BMPimage = NULL;
+	char *treeData = NULL;
+	size_t treeLength = 0;
+	unsigned long long hash = 0;
+	FILE *fout;
+
+	memset( &reply, 0, sizeof( reply ) );
+	memcpy( reply.tag, "QTA1", 4 );
+	reply.status = 1;
+
+	auto start = chrono::steady_clock::now();
+	if ( !readAll( fd, &request, sizeof( request ) ) ||
+		memcmp( request.tag, "QTQ1", 4 ) != 0 || request.length > maxPayload ||
+		request.criterion < MAX_DEVIATION || request.criterion > SSE_BUDGET )
+	{
+		writeAll( fd, &reply, sizeof( reply ) );
+		return;
+	}
+	crit = (SplitCriterion) request.criterion;
+
+	if ( request.kind == REQUEST_PATH && request.length < PATH_MAX )
+	{
+		string path( request.length, '\0' );
+		if ( readAll( fd, &path[0], request.length ) &&
+			LoadBmpFile( path.c_str(), reply.rows, reply.cols, BMPimage ) &&
+			powerOfTwo( reply.rows ) && powerOfTwo( reply.cols ) )
+		{
+			gray.resize( size_t( reply.rows ) * reply.cols );
+			ConvertToMonochrome( BMPimage, reply.rows, reply.cols, gray.data(),
+				&hash );
+			reply.status = 0;
+		}
+		delete [] BMPimage;
+	}
+	else if ( request.kind == REQUEST_PIXELS && powerOfTwo( request.rows ) &&
+		powerOfTwo( request.cols ) &&
+		(long long) request.rows * request.cols == request.length )
+	{
+		reply.rows = request.rows;
+		reply.cols = request.cols;
+		gray.resize( request.length );
+		if ( readAll( fd, gray.data(), request.length ) )
+		{
+			if ( cache.enabled() )
+				hash = HashMonochrome( gray.data(), reply.rows, reply.cols );
+			reply.status = 0;
+		}
+	}
+
+	if ( reply.status == 0 )
+	{
+		tree.setImage( gray.data(), reply.rows, reply.cols, request.fudge, crit );
+		if ( !cache.lookup( hash, request.fudge, crit, tree ) )
+		{
+			tree.fillTree( tree.root, 0, 0, reply.rows );
+			if ( cache.enabled() )
+				cache.store( hash, request.fudge, crit, tree );
+		}
+		reply.nodes = tree.nodes();
+		reply.leaves = tree.leaves();
+
+		fout = open_memstream( &treeData, &treeLength );
+		if ( fout == NULL || !tree.save( fout ) )
+			reply.status = 1;
+		if ( fout != NULL )
+			fclose( fout );
+		reply.length = reply.status == 0 ? treeLength : 0;
+	}
+	reply.encodeMs = chrono::duration<double, milli>(
+		chrono::steady_clock::now() - start ).count();
+
+	if ( writeAll( fd, &reply, sizeof( reply ) ) && reply.length > 0 )
+		writeAll( fd, treeData, reply.length );
+	free( treeData );
+}
+
+/**************************************************************************//**
+ * @par Description:
+ * Worker thread: waits for queued connections and serves them with its
+ * own warm tree and image buffer. After each request the tree is trimmed
+ * and a large image buffer freed, so a worker only keeps what a typical
+ * request needs. While another worker is idle it takes
+ * one connection at a time, leaving the rest of a burst to the workers
+ * woken for it. When all the others are busy it takes up to batch at
+ * once, and before starting each one after the first it checks again: if
+ * a worker has gone idle the rest go back to the front of the queue.
+ *
+ * @param[in]   batch - most connections to take at once
+ *
+ *****************************************************************************/
+void worker( int batch )
+{
+	quadTree tree;
+	vector<byte> gray;
+	vector<int> fds;
+	encodeCache cache;
+	size_t next;
+	bool large;
+
+	while ( true )
+	{
+		{
+			unique_lock<mutex> lock( pendingLock );
+			idleWorkers++;
+			pendingReady.wait( lock, [] { return !pending.empty(); } );
+			idleWorkers--;
+			do
+			{
+				fds.push_back( pending.front() );
+				pending.pop_front();
+			} while ( !pending.empty() && idleWorkers == 0 &&
+				(int) fds.size() < batch );
+		}
+
+		for ( next = 0; next < fds.size(); next++ )
+		{
+			if ( next > 0 )
+			{
+				lock_guard<mutex> lock( pendingLock );
+				if ( idleWorkers > 0 )
+				{
+					pending.insert( pending.begin(), fds.begin() + next,
+						fds.end() );
+					pendingReady.notify_all();
+					break;
+				}
+			}
+			serveRequest( fds[next], tree, gray, cache );
+			close( fds[next] );
+
+			//The allocator keeps freed memory for itself unless told to
+			//give it back to the system
+			large = tree.nodes() > keepNodes || gray.size() > keepNodes;
+			tree.trim( keepNodes );
+			if ( large )
+			{
+				vector<byte>().swap( gray );
+				malloc_trim( 0 );
+			}
+		}
+		fds.clear();
+	}
+}
+
+/**************************************************************************//**
+ * @par Description:
+ * Runs the server: binds the socket, starts the workers and queues every
+ * connection accepted. Never returns unless the socket cannot be set up.
+ *
+ * @param[in]   path - socket path
+ * @param[in]   workers - number of worker threads
+ * @param[in]   batch - most connections a worker takes at once
+ * @param[in]   timeout - seconds a read may wait before the request is
+ *                          dropped
+ *
+ * @returns -1 if the socket could not be set up
+ *
+ *****************************************************************************/
+int serve( const char *path, int workers, int batch, int timeout )
+{
+	struct sockaddr_un addr;
+	struct timeval wait;
+	int listener, fd, i;
+
+	memset( &addr, 0, sizeof( addr ) );
+	addr.sun_family = AF_UNIX;
+	if ( strlen( path ) >= sizeof( addr.sun_path ) )
+	{
+		cerr << "Error: socket path too long: " << path << endl;
+		return -1;
+	}
+	strcpy( addr.sun_path, path );
+
+	listener = socket( AF_UNIX, SOCK_STREAM, 0 );
+	unlink( path );
+	if ( listener < 0 || bind( listener, (struct sockaddr *) &addr,
+		sizeof( addr ) ) != 0 || listen( listener, SOMAXCONN ) != 0 )
+	{
+		perror( path );
+		return -1;
+	}
+
+	//A client hanging up early must not kill the server
+	signal( SIGPIPE, SIG_IGN );
+
+	for ( i = 0; i < workers; i++ )
+		thread( worker, batch ).detach();
+	cerr << "listening on " << path << " with " << workers << " workers"
+		<< endl;
+
+	while ( true )
+	{
+		fd = accept( listener, NULL, NULL );
+		if ( fd < 0 )
+			continue;
+
+		//A client that connects and sends nothing must not hold a worker
+		wait.tv_sec = timeout;
+		wait.tv_usec = 0;
+		setsockopt( fd, SOL_SOCKET, SO_RCVTIMEO, &wait, sizeof( wait ) );
+		{
+			lock_guard<mutex> lock( pendingLock );
+			pending.push_back( fd );
+		}
+		pendingReady.notify_one();
+	}
+}
+
+/**************************************************************************//**
+ * @par Description:
+ * Client: asks the server to encode a BMP file, prints the statistics it
+ * sends back and optionally writes the tree to a file, as it is or in the
+ * flat layout.
+ *
+ * @param[in]   path - socket path
+ * @param[in]   filename - the BMP file to encode
+ * @param[in]   factor - the fudge factor
+ * @param[in]   crit - the split criterion
+ * @param[in]   outName - file to write the tree to, or NULL
+ * @param[in]   flatName - file to write the flat tree to, or NULL
+ *
+ * @returns 0 on success, -1 otherwise
+ *
+ *****************************************************************************/
+int encode( const char *path, const char *filename, int factor,
+	SplitCriterion crit, const char *outName, const char *flatName )
+{
+	struct sockaddr_un addr;
+	EncodeRequest request;
+	EncodeReply reply;
+	char fullName[PATH_MAX];
+	vector<char> treeData;
+	quadTree tree;
+	FILE *fin;
+	FILE *fout;
+	int fd;
+
+	//The server does not share our working directory
+	if ( realpath( filename, fullName ) == NULL )
+	{
+		perror( filename );
+		return -1;
+	}
+
+	memset( &addr, 0, sizeof( addr ) );
+	addr.sun_family = AF_UNIX;
+	strncpy( addr.sun_path, path, sizeof( addr.sun_path ) - 1 );
+	fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+	if ( fd < 0 || connect( fd, (struct sockaddr *) &addr, sizeof( addr ) ) != 0 )
+	{
+		perror( path );
+		return -1;
+	}
+
+	memset( &request, 0, sizeof( request ) );
+	memcpy( request.tag, "QTQ1", 4 );
+	request.kind = REQUEST_PATH;
+	request.fudge = factor;
+	request.criterion = crit;
+	request.length = strlen( fullName );
+	if ( !writeAll( fd, &request, sizeof( request ) ) ||
+		!writeAll( fd, fullName, request.length ) ||
+		!readAll( fd, &reply, sizeof( reply ) ) || reply.status != 0 )
+	{
+		cerr << "Error: server could not encode " << filename << endl;
+		close( fd );
+		return -1;
+	}
+	treeData.resize( reply.length );
+	if ( !readAll( fd, treeData.data(), reply.length ) )
+	{
+		cerr << "Error: incomplete reply from server" << endl;
+		close( fd );
+		return -1;
+	}
+	close( fd );
+
+	cout << reply.rows << " x " << reply.cols << ": " << reply.nodes
+		<< " nodes and " << reply.leaves << " leaves in " << reply.encodeMs
+		<< " ms (" << reply.length << " byte tree)." << endl;
+
+	if ( outName )
+	{
+		fout = fopen( outName, "wb" );
+		if ( fout == NULL || fwrite( treeData.data(), 1, treeData.size(),
+			fout ) != treeData.size() )
+		{
+			perror( outName );
+			return -1;
+		}
+		fclose( fout );
+	}
+
+	if ( flatName )
+	{
+		fin = fmemopen( treeData.data(), treeData.size(), "rb" );
+		if ( fin == NULL ||
+			!tree.setImage( NULL, reply.rows, reply.cols, 0, crit ) ||
+			!tree.load( fin ) )
+		{
+			cerr << "Error: server sent a tree that could not be read" << endl;
+			return -1;
+		}
+		fclose( fin );
+
+		fout = fopen( flatName, "wb" );
+		if ( fout == NULL || !tree.saveFlat( fout ) )
+		{
+			perror( flatName );
+			return -1;
+		}
+		fclose( fout );
+	}
+	return 0;
+}
+
+/**************************************************************************//**
+ * @par Description:
+ * Maps a flat tree file and prints the decoded value of each pixel asked
+ * for. Nothing is read into memory beyond the pages the walks touch.
+ *
+ * @param[in]   filename - the flat tree file
+ * @param[in]   coords - row and column pairs, row 0 is the bottom row
+ * @param[in]   count - number of strings in coords
+ *
+ * @returns 0 on success, -1 otherwise
+ *
+ *****************************************************************************/
+int lookup( const char *filename, char *coords[], int count )
+{
+	flatTree tree;
+	int row;
+	int col;
+	int i;
+
+	if ( !tree.open( filename ) )
+	{
+		cerr << "Error: " << filename << " is not a flat tree file" << endl;
+		return -1;
+	}
+
+	cout << tree.rows() << " x " << tree.cols() << ": " << tree.nodes()
+		<< " nodes and " << tree.leaves() << " leaves." << endl;
+	for ( i = 0; i + 1 < count; i += 2 )
+	{
+		row = atoi( coords[i] );
+		col = atoi( coords[i + 1] );
+		cout << row << " " << col << " " << (int) tree.value( row, col )
+			<< endl;
+	}
+	return 0;
+}
+
+/**************************************************************************//**
+ * @par Description:
+ * Reads a tree written by quadTree::save, taking the image size from the
+ * file's header
+ *
+ * @param[in]   filename - the tree file
+ * @param[out]  tree - the tree to read into
+ *
+ * @returns true if the tree was read, false otherwise
+ *
+ *****************************************************************************/
+bool readTree( const char *filename, quadTree &tree )
+{
+	FILE *fin = fopen( filename, "rb" );
+	char tag[4];
+	int dims[2];
+	bool ok;
+
+	if ( fin == NULL )
+		return false;
+	ok = fread( tag, 1, 4, fin ) == 4 && fread( dims, sizeof( int ), 2, fin ) == 2;
+	if ( ok )
+	{
+		rewind( fin );
+		ok = tree.setImage( NULL, dims[0], dims[1], 0, MAX_DEVIATION ) &&
+			tree.load( fin );
+	}
+	fclose( fin );
+	return ok;
+}
+
+/**************************************************************************//**
+ * @par Description:
+ * Prints the rectangles where two saved trees decode to different values,
+ * one per line as the bottom row, left column, rows, columns and the
+ * change in value from the first tree to the second
+ *
+ * @param[in]   oldName - the first tree file
+ * @param[in]   newName - the second tree file
+ *
+ * @returns 0 on success, -1 otherwise
+ *
+ *****************************************************************************/
+int diff( const char *oldName, const char *newName )
+{
+	quadTree first, second;
+	vector<TreeChange> changes;
+	long long pixels = 0;
+	unsigned int i;
+
+	if ( !readTree( oldName, first ) || !readTree( newName, second ) )
+	{
+		cerr << "Error: could not read the trees" << endl;
+		return -1;
+	}
+	if ( !first.diff( second, changes ) )
+	{
+		cerr << "Error: the trees are of different sizes" << endl;
+		return -1;
+	}
+
+	for ( i = 0; i < changes.size(); i++ )
+	{
+		cout << changes[i].y - changes[i].rows << " " << changes[i].x << " "
+			<< changes[i].rows << " " << changes[i].cols << " "
+			<< changes[i].delta << endl;
+		pixels += (long long) changes[i].rows * changes[i].cols;
+	}
+	cerr << changes.size() << " changed rectangles covering " << pixels
+		<< " pixels." << endl;
+	return 0;
+}
+
+/**************************************************************************//**
+ * @par Description:
+ * Parses the command line and runs the server or the client
+ *
+ * @param[in]	argc - number of arguments
+ * @param[in]	*argv[] - see the usage in the file header
+ *
+ * @returns 0 on success, -1 otherwise
+ *
+ *****************************************************************************/
+int main( int argc, char *argv[] )
+{
+	const char *path = getenv( "QT_SOCKET" ) ? getenv( "QT_SOCKET" ) :
+		"/tmp/quadTree.sock";
+	const char *outName = NULL;
+	const char *flatName = NULL;
+	int workers = thread::hardware_concurrency();
+	int batch = 8;
+	int timeout = 5;
+	SplitCriterion crit = MAX_DEVIATION;
+	int opt;
+
+	if ( argc < 2 || ( strcmp( argv[1], "serve" ) != 0 &&
+		strcmp( argv[1], "encode" ) != 0 && strcmp( argv[1], "lookup" ) != 0 &&
+		strcmp( argv[1], "diff" ) != 0 ) )
+	{
+		cerr << "Usage: quadTreeServer serve [-s socket] [-w workers] [-b batch]"
+			" [-t seconds]\n"
+			"       quadTreeServer encode [-s socket] [-o tree.qtr] [-f tree.qtf]"
+			" image.bmp fudge [max|variance|sse]\n"
+			"       quadTreeServer lookup tree.qtf row col [row col ...]\n"
+			"       quadTreeServer diff old.qtr new.qtr\n";
+		return -1;
+	}
+
+	if ( strcmp( argv[1], "lookup" ) == 0 )
+	{
+		if ( argc < 5 )
+		{
+			cerr << "Error: lookup needs a file and a row and column" << endl;
+			return -1;
+		}
+		return lookup( argv[2], argv + 3, argc - 3 );
+	}
+
+	if ( strcmp( argv[1], "diff" ) == 0 )
+	{
+		if ( argc != 4 )
+		{
+			cerr << "Error: diff needs two tree files" << endl;
+			return -1;
+		}
+		return diff( argv[2], argv[3] );
+	}
+
+	optind = 2;
+	while ( ( opt = getopt( argc, argv, "s:w:b:t:o:f:" ) ) != -1 )
+	{
+		switch ( opt )
+		{
+			case 's': path = optarg; break;
+			case 'w': workers = atoi( optarg ); break;
+			case 'b': batch = atoi( optarg ); break;
+			case 't': timeout = atoi( optarg ); break;
+			case 'o': outName = optarg; break;
+			case 'f': flatName = optarg; break;
+			default: return -1;
+		}
+	}
+
+	if ( strcmp( argv[1], "serve" ) == 0 )
+		return serve( path, max( workers, 1 ), max( batch, 1 ),
+			max( timeout, 1 ) );
+
+	if ( argc - optind < 2 )
+	{
+		cerr << "Error: encode needs an image and a fudge factor" << endl;
+		return -1;
+	}
+	if ( argc - optind > 2 && !parseCriterion( argv[optind + 2], crit ) )
+	{
+		cerr << "Error: unknown criterion " << argv[optind + 2] << endl;
+		return -1;
+	}
+	return encode( path, argv[optind], atoi( argv[optind + 1] ), crit, outName,
+		flatName );
+}
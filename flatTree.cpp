@@ -0,0 +1,249 @@
+/**************************************************************************//**
+ * @file
+ * @brief The implementation of the flatTree class
+ *
+ * The pixel types used by basicQuadTree are instantiated at the end of the
+ * file.
+ *****************************************************************************/
+
+//Include statements
+#include "flatTree.h"
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+//Constructor, no file is open
+template <typename Pixel>
+basicFlatTree<Pixel>::basicFlatTree()
+{
+}
+
+//Destructor, unmaps the file
+template <typename Pixel>
+basicFlatTree<Pixel>::~basicFlatTree()
+{
+	close();
+}
+
+ /**************************************************************************//**
+ * @par Description:
+ * Maps a file written by quadTree::saveFlat read-only. Only the header is
+ * checked, so opening takes the same time whatever the size of the tree;
+ * the child indices are checked as they are followed instead.
+ *
+ * @param[in]      filename - the file to open
+ *
+ * @returns true if the file was mapped, false otherwise
+ *
+ *****************************************************************************/
+template <typename Pixel>
+bool basicFlatTree<Pixel>::open(const char *filename)
+{
+	struct stat info;
+	void *map;
+	int fd;
+
+	close();
+	fd = ::open(filename, O_RDONLY);
+	if (fd < 0)
+		return false;
+	if (fstat(fd, &info) != 0 || (size_t) info.st_size < sizeof(FlatHeader))
+	{
+		::close(fd);
+		return false;
+	}
+
+	//The mapping stays valid after the descriptor is closed
+	map = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (map == MAP_FAILED)
+		return false;
+
+	data = (const char *) map;
+	length = info.st_size;
+	header = (const FlatHeader *) data;
+	if (memcmp(header->tag, "QTF1", 4) != 0 || header->rows == 0 ||
+		header->cols == 0 || header->pixelSize != sizeof(Pixel) ||
+		header->nodes == 0 ||
+		header->valueOffset != flatValueOffset(header->nodes) ||
+		header->valueOffset + (uint64_t) header->nodes * sizeof(Pixel) > length)
+	{
+		close();
+		return false;
+	}
+
+	children = (const uint32_t *) (data + sizeof(FlatHeader));
+	values = (const Pixel *) (data + header->valueOffset);
+	return true;
+}
+
+ /**************************************************************************//**
+ * @par Description:
+ * Unmaps the file, if one is open
+ *
+ *****************************************************************************/
+template <typename Pixel>
+void basicFlatTree<Pixel>::close()
+{
+	if (data != nullptr)
+		munmap((void *) data, length);
+	data = nullptr;
+	length = 0;
+	header = nullptr;
+	children = nullptr;
+	values = nullptr;
+}
+
+//Returns the image dimensions in rows, 0 when no file is open
+template <typename Pixel>
+int basicFlatTree<Pixel>::rows()
+{
+	return header ? header->rows : 0;
+}
+
+//Returns the image dimensions in columns, 0 when no file is open
+template <typename Pixel>
+int basicFlatTree<Pixel>::cols()
+{
+	return header ? header->cols : 0;
+}
+
+//Returns the number of nodes, 0 when no file is open
+template <typename Pixel>
+unsigned int basicFlatTree<Pixel>::nodes()
+{
+	return header ? header->nodes : 0;
+}
+
+//Returns the number of leaves, 0 when no file is open
+template <typename Pixel>
+unsigned int basicFlatTree<Pixel>::leaves()
+{
+	return header ? header->leaves : 0;
+}
+
+ /**************************************************************************//**
+ * @par Description:
+ * Returns the index of the first child of a node. Children always come
+ * after their parent, so an index that does not, or whose four children
+ * would run past the end of the file, is treated as a leaf. This also
+ * keeps a corrupt file from sending a walk round in circles.
+ *
+ * @param[in]      node - index of the node
+ *
+ * @returns index of the ul child, 0 for a leaf
+ *
+ *****************************************************************************/
+template <typename Pixel>
+uint32_t basicFlatTree<Pixel>::firstChild(uint32_t node)
+{
+	uint32_t child = children[node];
+
+	if (child <= node || header->nodes < 4 || child > header->nodes - 4)
+		return 0;
+	return child;
+}
+
+ /**************************************************************************//**
+ * @par Description:
+ * Returns the decoded value of one pixel by walking from the root down to
+ * the leaf that covers it. Only the nodes on the way are touched, so a
+ * query reads a handful of pages of the file.
+ *
+ * @param[in]      row - row of the pixel, 0 is the bottom row
+ * @param[in]      col - column of the pixel
+ *
+ * @returns the mean of the leaf covering the pixel, 0 outside the image
+ *
+ *****************************************************************************/
+template <typename Pixel>
+Pixel basicFlatTree<Pixel>::value(int row, int col)
+{
+	uint32_t node = 0;
+	uint32_t child;
+	int level = 0;
+	int x = 0;
+	int y;
+	int halfRows;
+	int halfCols;
+	bool upper;
+	bool right;
+
+	if (header == nullptr || row < 0 || col < 0 || row >= rows() ||
+		col >= cols())
+		return 0;
+
+	//The region of the node covers rows y - rows .. y - 1, like in quadTree
+	y = rows();
+	while ((child = firstChild(node)) != 0)
+	{
+		level++;
+		halfRows = rows() >> level;
+		halfCols = cols() >> level;
+		upper = row >= y - halfRows;
+		right = col >= x + halfCols;
+		if (!upper)
+			y -= halfRows;
+		if (right)
+			x += halfCols;
+		node = child + (upper ? 0 : 2) + (right ? 1 : 0);
+	}
+	return values[node];
+}
+
+ /**************************************************************************//**
+ * @par Description:
+ * Decodes the tree into an image array straight from the mapped file
+ *
+ * @param[out]     out - image array of rows() x cols() to fill
+ *
+ *****************************************************************************/
+template <typename Pixel>
+void basicFlatTree<Pixel>::decode(Pixel *out)
+{
+	if (header != nullptr)
+		decodeNode(0, 0, 0, rows(), out);
+}
+
+ /**************************************************************************//**
+ * @par Description:
+ * Fills the region of every leaf below a node with the leaf's value
+ *
+ * @param[in]      node - index of the node
+ * @param[in]      level - the level of the node
+ * @param[in]      x - the x coordinate for the node's corner pixel
+ * @param[in]      y - the y coordinate for the node's corner pixel
+ * @param[out]     out - image array of rows() x cols() to fill
+ *
+ *****************************************************************************/
+template <typename Pixel>
+void basicFlatTree<Pixel>::decodeNode(uint32_t node, int level, int x, int y,
+	Pixel *out)
+{
+	uint32_t child = firstChild(node);
+	int nrows = rows() >> level;
+	int ncols = cols() >> level;
+	int i;
+
+	if (child != 0 && nrows > 1 && ncols > 1)
+	{
+		decodeNode(child, level + 1, x, y, out);
+		decodeNode(child + 1, level + 1, x + ncols / 2, y, out);
+		decodeNode(child + 2, level + 1, x, y - nrows / 2, out);
+		decodeNode(child + 3, level + 1, x + ncols / 2, y - nrows / 2, out);
+		return;
+	}
+
+	for (i = 0; i < nrows; i++)
+		fill_n(out + size_t(i + y - nrows) * cols() + x, ncols, values[node]);
+}
+
+//The pixel types of basicQuadTree
+template class basicFlatTree<unsigned char>;
+template class basicFlatTree<unsigned short>;
+template class basicFlatTree<float>;
@@ -0,0 +1,120 @@
+/**
+ *  @file
+ *
+ *  @brief The flatTree class gives read-only access to a quadtree file
+ *  written by quadTree::saveFlat without reading it into Node objects.
+ *
+ *  The file is mapped into memory and used as it is. It holds a header, the
+ *  index of the first child of every node, and the value (the mean) of every
+ *  node. Nodes are stored level by level, so the four children of a parent
+ *  (ul, ur, ll, lr) are next to each other and always come after it. A
+ *  leaf's first child is 0, which is the root and so never a child. Indices
+ *  rather than pointers make the file position independent: opening it
+ *  costs an open and an mmap whatever its size, and every process mapping
+ *  the same file shares the same pages.
+ *
+ *  The class is a template over the pixel type like basicQuadTree; flatTree
+ *  reads the files of the 8-bit quadTree.
+ *
+ *  @class basicFlatTree
+ */
+
+#ifndef _flat_Tree_
+#define _flat_Tree_
+
+#include <cstddef>
+#include <cstdint>
+
+///Header at the start of a flat tree file
+struct FlatHeader
+{
+	///"QTF1"
+	char tag[4];
+
+	///Image dimensions in rows
+	uint32_t rows;
+
+	///Image dimensions in columns
+	uint32_t cols;
+
+	///Size of a pixel in bytes
+	uint32_t pixelSize;
+
+	///Number of nodes in the tree
+	uint32_t nodes;
+
+	///Number of leaves in the tree
+	uint32_t leaves;
+
+	///Offset of the values from the start of the file
+	uint64_t valueOffset;
+};
+
+///Offset of the values in a file holding the given number of nodes
+inline uint64_t flatValueOffset(uint32_t nodes)
+{
+	//Keep the values 8 byte aligned after the child indices
+	return (sizeof(FlatHeader) + 4 * (uint64_t) nodes + 7) & ~(uint64_t) 7;
+}
+
+//flatTree class interface
+template <typename Pixel>
+class basicFlatTree
+{
+	private:
+		///Start of the mapping, nullptr when no file is open
+		const char *data = nullptr;
+
+		///Length of the mapping in bytes
+		size_t length = 0;
+
+		///Header of the open file
+		const FlatHeader *header = nullptr;
+
+		///Index of the first child of every node, 0 for a leaf
+		const uint32_t *children = nullptr;
+
+		///Mean value of every node
+		const Pixel *values = nullptr;
+
+		///Returns the first child of a node, 0 if it is a leaf
+		uint32_t firstChild(uint32_t node);
+
+		///Writes the mean of every leaf below a node into an image array
+		void decodeNode(uint32_t node, int level, int x, int y, Pixel *out);
+	public:
+		///Constructor
+		basicFlatTree();
+
+		///Destructor, unmaps the file
+		~basicFlatTree();
+
+		///Maps a file written by quadTree::saveFlat
+		bool open(const char *filename);
+
+		///Unmaps the file
+		void close();
+
+		///Image dimensions in rows
+		int rows();
+
+		///Image dimensions in columns
+		int cols();
+
+		///Returns the number of nodes
+		unsigned int nodes();
+
+		///Returns the number of leaves
+		unsigned int leaves();
+
+		///Returns the decoded value of one pixel
+		Pixel value(int row, int col);
+
+		///Writes the mean of every leaf into an image array
+		void decode(Pixel *out);
+};
+
+///Reads the files of the 8-bit quadTree
+typedef basicFlatTree<unsigned char> flatTree;
+
+#endif
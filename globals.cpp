@@ -14,9 +14,12 @@ int ScreenHeight = 768;
 byte* BMPimage;
 byte* image;
 byte* image2;
-byte* image3;
 int nrows, ncols;
 int fudge;
+SplitCriterion criterion = MAX_DEVIATION;
 quadTree* ourTree = new quadTree;
 bool overlay = false;
+double zoom = 1;
+double viewLeft = 0;
+double viewBottom = 0;
 
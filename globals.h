@@ -25,16 +25,22 @@ extern byte* BMPimage;
 extern byte* image; 
 /// array of bytes to store monochrome pixel values after quadtree encoding	      
 extern byte* image2;
-/// array of bytes to store monochrome pixel values with overlay
-extern byte* image3;
 /// image dimensions in rows
 extern int nrows;
 /// image dimensions in columns
 extern int ncols;  
 /// quality factor 
 extern int fudge;
+/// test used to decide when a region is divided
+extern SplitCriterion criterion;
 /// the quadtree
 extern quadTree* ourTree;
 ///Bool to toggle overlay
 extern bool overlay;
+/// screen pixels per image pixel in the viewer
+extern double zoom;
+/// image column at the left edge of the view
+extern double viewLeft;
+/// image row at the bottom edge of the view
+extern double viewBottom;
 #endif
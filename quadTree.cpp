@@ -1,219 +1,1855 @@
-/**************************************************************************//** 
+/**************************************************************************//**
  * @file
  * @brief The implimentation of the quadTree class
+ *
+ * Every member is a template over the pixel type, the accumulator type and
+ * the fixed image size (0 when the size is only known at run time). The
+ * combinations used by the programs are instantiated at the end of the file.
  *****************************************************************************/
 
 //Include statements
 #include "quadTree.h"
-#include "globals.h"
+#include "treeStats.h"
+#include "flatTree.h"
 #include <iostream>
-#include <cmath>
 #include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <unordered_map>
 
 using namespace std;
 
 //Constructor, root is null
-quadTree::quadTree()
+template <typename Pixel, typename Accum, int Size>
+basicQuadTree<Pixel, Accum, Size>::basicQuadTree()
 {
 	root = NULL;
 }
 
-//Destructor, calls the recursive deleteAll function to deallocate memory
-quadTree::~quadTree()
+//Destructor, calls the recursive deleteAll function to release the nodes,
+//then deallocates them along with the tables
+template <typename Pixel, typename Accum, int Size>
+basicQuadTree<Pixel, Accum, Size>::~basicQuadTree()
 {
+	Node *next;
+
 	//Deallocate the memory
 	deleteAll(root);
+	freeTables();
+	while (freeNodes != nullptr)
+	{
+		next = freeNodes->ul;
+		delete freeNodes;
+		freeNodes = next;
+	}
+}
+
+ /**************************************************************************//**
+ * @par Description:
+ * Sets the image, fudge factor and split criterion the next call to
+ * fillTree builds the tree from. Each tree keeps its own copy of these so
+ * several trees can be built at the same time. fillTree halves every
+ * region until it is a single pixel, so both sides of the image must be
+ * powers of two; any other size would leave the last row or column of odd
+ * sized regions without a leaf. A fixed size tree only accepts images of
+ * its size.
+ *
+ * @param[in]      pixels - monochrome image, rows x cols, bottom row first
+ * @param[in]      rows - image dimensions in rows
+ * @param[in]      cols - image dimensions in columns
+ * @param[in]      factor - the fudge factor
+ * @param[in]      crit - the split criterion
+ *
+ * @returns false if a side is not a power of two or the image does not
+ *          fit a fixed size tree
+ *
+ *****************************************************************************/
+template <typename Pixel, typename Accum, int Size>
+bool basicQuadTree<Pixel, Accum, Size>::setImage(const Pixel *pixels,
+	int rows, int cols, double factor, SplitCriterion crit)
+{
+	if (!powerOfTwo(rows) || !powerOfTwo(cols) ||
+		(Size != 0 && (rows != Size || cols != Size)))
+		return false;
+
+	image = pixels;
+	nrows = rows;
+	ncols = cols;
+	fudge = factor;
+	criterion = crit;
+	return true;
+}
+
+ /**************************************************************************//**
+ * @par Description:
+ * Returns a fresh node. Nodes released by deleteAll are reused before new
+ * ones are allocated, so a tree that is rebuilt over and over (the
+ * benchmark, the encode server) stops calling the allocator once warm.
+ *
+ * @returns pointer to a node with default values
+ *
+ *****************************************************************************/
+template <typename Pixel, typename Accum, int Size>
+typename basicQuadTree<Pixel, Accum, Size>::Node *
+basicQuadTree<Pixel, Accum, Size>::newNode()
+{
+	Node *node = freeNodes;
+
+	if (node == nullptr)
+		return new Node;
+	freeNodes = node->ul;
+	freeCount--;
+	*node = Node();
+	return node;
 }
 
- /**************************************************************************//** 
+ /**************************************************************************//**
  * @author Cheldon Coughlen
  * @author Chris Hjelmfelt
- * 
- * @par Description: 
+ *
+ * @par Description:
  * Creates the nodes of our quad tree from the image array, recursive
- * counts nodes and leaves, creates leaves based on regions of similar value
- * when spacebar is pressed prints our image with lines overlayed
- * 
+ * counts nodes and leaves, creates leaves based on regions of similar value.
+ * The decoded image is produced afterwards by decode or render. The
+ * error of every leaf is added up as it is created, see squaredError.
+ * A fixed size tree hands the work to fillLevel from the root.
+ *
  * @param[in,out]      current - a pointer to the current node
  * @param[in]          level - the level of the tree we are currently at
  * @param[in]          x - the x coordinate for our corner pixel
  * @param[in]          y - the y coordinate for our corner pixel
- * 
+ *
  *****************************************************************************/
-void quadTree::fillTree(Node*& current, int level, int x, int y)
+template <typename Pixel, typename Accum, int Size>
+void basicQuadTree<Pixel, Accum, Size>::fillTree(Node*& current, int level,
+	int x, int y)
 {
 	//Variables
-	int val = 0;
-	int rows;
-	int cols;
-	int i, j;
-	
+	int rows = nrows >> level;
+	int cols = ncols >> level;
+	STATS_START(statsStart);
+
+	//Starting a new tree, throw away the old one and rebuild the tables
+	if (level == 0)
+	{
+		deleteAll(root);
+		numNodes = 0;
+		numLeaves = 0;
+		sumSquaredError = 0;
+		errorKnown = true;
+		buildTables();
+
+		if (Size != 0)
+		{
+			fillLevel(current, x, y, integral_constant<int, 0>());
+			root = current;
+			return;
+		}
+	}
+
 	//Allocate new node for current, check for success
-	current = new Node;
+	current = newNode();
 	if (level == 0)
 		root = current;
 	if (current == NULL)
 		return;
-		
+
 	//Increment count for number of nodes
 	numNodes++;
-	
+
 	//Set current's x, y, and level
 	current->x = x;
 	current->y = y;
 	current->level = level;
-	
-	//Check the values within the current sub-quadrant
-	val = valueMatch(current);
-	
-	//If the values aren't within the tolerance, divide the region
-	if (val == -1)
-	{
-		//Set value to -1 to indicate parent, not leaf
-		current->value = val;
-		
+
+	//If the values aren't within the tolerance, divide the region. A region
+	//one pixel high or wide cannot be divided.
+	if (!valueMatch(current, rows, cols) && rows > 1 && cols > 1)
+	{
 		//Recursively traverse the 4 sub-regions of the current region
 		fillTree(current->ul, level + 1, x, y);
-		fillTree(current->ur, level + 1, x + ncols / pow(2, level + 1), y);
-		fillTree(current->ll, level + 1, x, y - nrows / pow(2, level + 1)); 
-		fillTree(current->lr, level + 1, x + ncols / pow(2, level + 1), 
-			y - nrows / pow(2, level + 1));
+		fillTree(current->ur, level + 1, x + cols / 2, y);
+		fillTree(current->ll, level + 1, x, y - rows / 2);
+		fillTree(current->lr, level + 1, x + cols / 2, y - rows / 2);
 	}
 	else
 	{
-		//Set the value to the mean returned by valueMatch
-		current->value = val;
-		
-		//Increment the number of leaves by 1
+		//Increment the number of leaves by 1 and add up its error
 		numLeaves += 1;
-		
-		//Determine the number of rows and columns for the region
-		rows = nrows / pow(2, current->level);
-		cols = ncols / pow(2, current->level);
-		
-		//Iteratively fill the region's values in the image2 array with the 
-		//mean value
-		for (i = 0; i < rows; i++)
-		{
-			for (j = 0; j < cols; j++)
-			{
-				image2[(i + current->y - rows) * (nrows) + j + current->x] = val;
-				image3[(i + current->y - rows) * (nrows) + j + current->x] = val;
-				
-				//Fills the bottom and left borders of the region with white
-				//for the overlay
-				if (i == 0 || j == 0)
-				{
-					image3[(i + current->y - rows) * (nrows) + j + current->x] = 255;
-				}
-			}
-		}
-		
-		//Fill top and right borders of overlay image with white
-		for (i = 0; i < ncols; i++)
-			image3[ncols * nrows - i] = 255;
-		for (i = 0; i < nrows; i++)
-			image3[ncols * (i + 1) - 1] = 255;
+		sumSquaredError += leafError(current, rows, cols);
 	}
+
+	hashNode(current);
+	STATS_NODE(level, (long long) rows * cols, current->ul == nullptr,
+		statsStart);
 	return;
 }
 
- /**************************************************************************//** 
+ /**************************************************************************//**
+ * @par Description:
+ * fillTree for a fixed size tree. The level is a template argument, so the
+ * size of the regions on the level is a compile-time constant and every
+ * level gets its own copy of the code with the table lookups of valueMatch
+ * reduced to constant offsets and shifts.
+ *
+ * @param[in,out]      current - a pointer to the current node
+ * @param[in]          x - the x coordinate for our corner pixel
+ * @param[in]          y - the y coordinate for our corner pixel
+ *
+ *****************************************************************************/
+template <typename Pixel, typename Accum, int Size>
+template <int Level>
+void basicQuadTree<Pixel, Accum, Size>::fillLevel(Node *&current, int x,
+	int y, integral_constant<int, Level>)
+{
+	const int rows = Size >> Level;
+	const int cols = Size >> Level;
+	STATS_START(statsStart);
+
+	current = newNode();
+	numNodes++;
+	current->x = x;
+	current->y = y;
+	current->level = Level;
+
+	if (!valueMatch(current, rows, cols) && Level < maxLevel)
+	{
+		fillLevel(current->ul, x, y, integral_constant<int, Level + 1>());
+		fillLevel(current->ur, x + cols / 2, y,
+			integral_constant<int, Level + 1>());
+		fillLevel(current->ll, x, y - rows / 2,
+			integral_constant<int, Level + 1>());
+		fillLevel(current->lr, x + cols / 2, y - rows / 2,
+			integral_constant<int, Level + 1>());
+	}
+	else
+	{
+		numLeaves += 1;
+		sumSquaredError += leafError(current, rows, cols);
+	}
+
+	hashNode(current);
+	STATS_NODE(Level, (long long) rows * cols, current->ul == nullptr,
+		statsStart);
+}
+
+//Below the single pixel level, never reached
+template <typename Pixel, typename Accum, int Size>
+void basicQuadTree<Pixel, Accum, Size>::fillLevel(Node *&, int, int,
+	integral_constant<int, maxLevel + 1>)
+{
+}
+
+ /**************************************************************************//**
+ * @author Cheldon Coughlen
+ * @author Chris Hjelmfelt
+ *
+ * @par Description:
+ * Decodes the tree into an image array by filling the region of every leaf
+ * with the leaf's mean value. A fixed size tree hands the work to
+ * decodeLevel from the root.
+ *
+ * @param[in]          current - a pointer to the current node
+ * @param[out]         out - image array of nrows x ncols to fill
+ *
+ *****************************************************************************/
+template <typename Pixel, typename Accum, int Size>
+void basicQuadTree<Pixel, Accum, Size>::decode(Node* current, Pixel* out)
+{
+	//Variables
+	int rows;
+	int cols;
+	int i;
+
+	if (current == nullptr)
+		return;
+
+	if (Size != 0 && current->level == 0)
+	{
+		decodeLevel(current, out, integral_constant<int, 0>());
+		return;
+	}
+
+	//Parents pass the work on to their four sub-regions
+	if (current->ul != nullptr)
+	{
+		decode(current->ul, out);
+		decode(current->ur, out);
+		decode(current->ll, out);
+		decode(current->lr, out);
+		return;
+	}
+
+	//Determine the number of rows and columns for the region
+	rows = nrows >> current->level;
+	cols = ncols >> current->level;
+
+	//Iteratively fill the region's values in the image array with the mean
+	for (i = 0; i < rows; i++)
+		fill_n(out + size_t(i + current->y - rows) * ncols + current->x, cols,
+			current->value);
+}
+
+ /**************************************************************************//**
+ * @par Description:
+ * decode for a fixed size tree. The level is a template argument, so the
+ * rows, columns and stride of the fill are compile-time constants and the
+ * compiler unrolls and vectorizes the fill of every level.
+ *
+ * @param[in]          current - a pointer to the current node
+ * @param[out]         out - image array of Size x Size to fill
+ *
+ *****************************************************************************/
+template <typename Pixel, typename Accum, int Size>
+template <int Level>
+void basicQuadTree<Pixel, Accum, Size>::decodeLevel(Node *current,
+	Pixel *out, integral_constant<int, Level>)
+{
+	const int rows = Size >> Level;
+	const int cols = Size >> Level;
+	Pixel *corner;
+	int i;
+
+	if (current->ul != nullptr)
+	{
+		decodeLevel(current->ul, out, integral_constant<int, Level + 1>());
+		decodeLevel(current->ur, out, integral_constant<int, Level + 1>());
+		decodeLevel(current->ll, out, integral_constant<int, Level + 1>());
+		decodeLevel(current->lr, out, integral_constant<int, Level + 1>());
+		return;
+	}
+
+	corner = out + size_t(current->y - rows) * Size + current->x;
+	for (i = 0; i < rows; i++)
+		fill_n(corner + size_t(i) * Size, cols, current->value);
+}
+
+//Below the single pixel level, never reached
+template <typename Pixel, typename Accum, int Size>
+void basicQuadTree<Pixel, Accum, Size>::decodeLevel(Node *, Pixel *,
+	integral_constant<int, maxLevel + 1>)
+{
+}
+
+ /**************************************************************************//**
+ * @par Description:
+ * Draws the part of the tree inside a viewport into a screen sized array.
+ * Screen pixel (i, j) shows the image at row bottom + (i + 0.5) / scale and
+ * column left + (j + 0.5) / scale. Nodes outside the viewport are skipped,
+ * and a node no bigger than a screen pixel is drawn with its mean instead
+ * of visiting its children, so the work depends on the size of the screen
+ * array rather than the image. With outline set, the bottom and left
+ * borders of leaves at least a screen pixel across are drawn in white (the
+ * largest pixel value, 1 for floating point pixels).
+ *
+ * @param[in]          current - a pointer to the current node
+ * @param[out]         out - screen array of outRows x outCols, bottom first
+ * @param[in]          outRows - rows of the screen array
+ * @param[in]          outCols - columns of the screen array
+ * @param[in]          left - image column at the left edge of the screen
+ * @param[in]          bottom - image row at the bottom edge of the screen
+ * @param[in]          scale - screen pixels per image pixel
+ * @param[in]          outline - true to draw the borders of the leaves
+ *
+ *****************************************************************************/
+template <typename Pixel, typename Accum, int Size>
+void basicQuadTree<Pixel, Accum, Size>::render(Node *current, Pixel *out,
+	int outRows, int outCols, double left, double bottom, double scale,
+	bool outline)
+{
+	const Pixel white = numeric_limits<Pixel>::is_integer ?
+		numeric_limits<Pixel>::max() : 1;
+	int rows;
+	int cols;
+	int r0, r1, c0, c1;
+	int i;
+
+	if (current == nullptr)
+		return;
+
+	//Screen pixels whose centers fall inside the region
+	rows = nrows >> current->level;
+	cols = ncols >> current->level;
+	r0 = screenIndex(current->y - rows, bottom, scale, outRows);
+	r1 = screenIndex(current->y, bottom, scale, outRows);
+	c0 = screenIndex(current->x, left, scale, outCols);
+	c1 = screenIndex(current->x + cols, left, scale, outCols);
+	if (r0 >= r1 || c0 >= c1)
+		return;
+
+	if (current->ul != nullptr && (rows * scale > 1 || cols * scale > 1))
+	{
+		render(current->ul, out, outRows, outCols, left, bottom, scale, outline);
+		render(current->ur, out, outRows, outCols, left, bottom, scale, outline);
+		render(current->ll, out, outRows, outCols, left, bottom, scale, outline);
+		render(current->lr, out, outRows, outCols, left, bottom, scale, outline);
+		return;
+	}
+
+	for (i = r0; i < r1; i++)
+		fill_n(out + size_t(i) * outCols + c0, c1 - c0, current->value);
+
+	//Borders that are cut off by the edge of the screen are not drawn
+	if (!outline || current->ul != nullptr || rows * scale < 1 ||
+		cols * scale < 1)
+		return;
+	if ((current->y - rows - bottom) * scale > -0.5)
+		fill_n(out + size_t(r0) * outCols + c0, c1 - c0, white);
+	if ((current->x - left) * scale > -0.5)
+		for (i = r0; i < r1; i++)
+			out[size_t(i) * outCols + c0] = white;
+}
+
+ /**************************************************************************//**
+ * @par Description:
+ * Returns the first screen pixel whose center is at or past an image
+ * position along one axis, clamped to the screen. See render.
+ *
+ * @param[in]          pos - image row or column
+ * @param[in]          origin - image row or column at the screen edge
+ * @param[in]          scale - screen pixels per image pixel
+ * @param[in]          count - screen pixels along the axis
+ *
+ * @returns index of the screen pixel, 0 to count
+ *
+ *****************************************************************************/
+template <typename Pixel, typename Accum, int Size>
+int basicQuadTree<Pixel, Accum, Size>::screenIndex(double pos, double origin,
+	double scale, int count)
+{
+	double index = ceil((pos - origin) * scale - 0.5);
+
+	if (index < 0)
+		return 0;
+	if (index > count)
+		return count;
+	return int(index);
+}
+
+ /**************************************************************************//**
  * @author Cheldon Coughlen
- * 
- * @par Description: 
+ *
+ * @par Description:
  * Returns the number of leaves in the tree
- * 
+ *
  * @returns number of leaves
- * 
+ *
  *****************************************************************************/
-unsigned int quadTree::leaves()
+template <typename Pixel, typename Accum, int Size>
+unsigned int basicQuadTree<Pixel, Accum, Size>::leaves()
 {
 	return numLeaves;
 }
 
- /**************************************************************************//** 
+ /**************************************************************************//**
  * @author Cheldon Coughlen
- * 
- * @par Description: 
+ *
+ * @par Description:
  * Returns the number of nodes
- * 
+ *
  * @returns number of nodes
- * 
+ *
  *****************************************************************************/
-unsigned int quadTree::nodes()
+template <typename Pixel, typename Accum, int Size>
+unsigned int basicQuadTree<Pixel, Accum, Size>::nodes()
 {
 	return numNodes;
 }
 
- /**************************************************************************//** 
+ /**************************************************************************//**
  * @author Cheldon Coughlen
  * @author Chris Hjelmfelt
- * @par Description: 
- * Checks for the values within the region against the fudge factor
- * 
- * @param[in]      current - a pointer to the current node
- * 
- * @returns mean of the values in the region or -1 for parent
- * 
+ * @par Description:
+ * Sets the region's value to its mean and checks the values within the
+ * region against the fudge factor using the selected split criterion. The
+ * sum, sum of squares, minimum and maximum of the region are looked up in
+ * the tables built by buildTables, so the test takes the same time for
+ * every region no matter how many pixels it covers. The mean of integer
+ * pixels is rounded down.
+ *   MAX_DEVIATION - every pixel must be within fudge of the mean
+ *   VARIANCE      - the variance must be no more than fudge squared
+ *   SSE_BUDGET    - the sum of squared error must be no more than fudge
+ *
+ * @param[in,out]  current - a pointer to the current node
+ * @param[in]      rows - the number of rows in the region
+ * @param[in]      cols - the number of columns in the region
+ *
+ * @returns true if the region is within the tolerance, false to divide it
+ *
  *****************************************************************************/
-int quadTree::valueMatch(Node *current)
+template <typename Pixel, typename Accum, int Size>
+bool basicQuadTree<Pixel, Accum, Size>::valueMatch(Node *current, int rows,
+	int cols)
 {
 	//Variables
-	long int sum = 0;
-	int i, j;
-	int mean = 0;
-	int rows = nrows / pow(2, current->level);
-	int cols = ncols / pow(2, current->level);
-	
-	//Iteratively find the sum of the values within the region
-	for (i = 0; i < rows; i++)
+	const size_t width = size_t(Size != 0 ? Size : ncols) + 1;
+	Accum count = Accum(rows) * cols;
+	int top = current->y;
+	int bottom = current->y - rows;
+	int left = current->x;
+	int right = current->x + cols;
+	int block;
+	Accum sum;
+	Accum sq;
+	Accum mean;
+	double sse;
+
+	//Find the sum of the values within the region from the integral image
+	sum = sumTable[top * width + right] - sumTable[bottom * width + right]
+		- sumTable[top * width + left] + sumTable[bottom * width + left];
+
+	//Calculate the mean using the sum, rows, and columns
+	mean = sum / count;
+	current->value = Pixel(mean);
+
+	if (criterion == MAX_DEVIATION)
 	{
-		for (j = 0; j < cols; j++)
-			sum += image[(i + current->y - rows) * (nrows) + j + current->x];
+		//The region passes if its extreme pixels are within the fudge factor
+		block = (bottom / rows) * (1 << current->level) + left / cols;
+		return double(maxTable[current->level][block]) - double(mean) <=
+			fudge && double(mean) - double(minTable[current->level][block])
+			<= fudge;
 	}
-	
-	//Calculate the mean using the sum, rows, and columns
-	mean = sum / (rows * cols);
-	
-	//Iteratively check if each pixel in the region is within the fudge factor
-	//from the mean
-	for (i = 0; i < rows; i++)
+
+	//Find the sum of the squared values within the region
+	sq = sqTable[top * width + right] - sqTable[bottom * width + right]
+		- sqTable[top * width + left] + sqTable[bottom * width + left];
+
+	//Sum of squared error around the mean of the region
+	sse = double(sq) - double(sum) * double(sum) / double(count);
+
+	if (criterion == VARIANCE)
+		return sse / double(count) <= fudge * fudge;
+	return sse <= fudge;
+}
+
+ /**************************************************************************//**
+ * @par Description:
+ * Returns the sum of squared error of the decoded image against the image
+ * the tree was built from. fillTree adds up the error of every leaf as it
+ * creates it, so after a build this costs nothing. A tree that was loaded
+ * or changed by pointOp is measured here by walking its leaves, which
+ * needs the tables built from the image first.
+ *
+ * @returns the sum of squared error, -1 if the tree has no image
+ *
+ *****************************************************************************/
+template <typename Pixel, typename Accum, int Size>
+double basicQuadTree<Pixel, Accum, Size>::squaredError()
+{
+	if (!errorKnown)
 	{
-		for (j = 0; j < cols; j++)
-			if (abs(image[(i + current->y - rows) * (nrows) + j + current->x]
-				- mean) > fudge)
-				//Return -1 when the value is not within the range
-				return -1;
+		if (image == nullptr || root == nullptr)
+			return -1;
+		buildTables();
+		sumSquaredError = treeError(root);
+		errorKnown = true;
 	}
-	
-	//Otherwise, return the mean of the region
-	return mean;
+	return sumSquaredError;
 }
 
- /**************************************************************************//** 
- * @author Cheldon Coughlen
- * 
- * @par Description: 
- * Frees memory by traversing recursively and then deleting nodes.
- * Called by the destructor.
- * 
+ /**************************************************************************//**
+ * @par Description:
+ * Returns the mean squared error of the decoded image, see squaredError
+ *
+ * @returns the mean squared error, -1 if the tree has no image
+ *
+ *****************************************************************************/
+template <typename Pixel, typename Accum, int Size>
+double basicQuadTree<Pixel, Accum, Size>::mse()
+{
+	double sse = squaredError();
+
+	return sse < 0 ? -1 : sse / (double(nrows) * ncols);
+}
+
+ /**************************************************************************//**
+ * @par Description:
+ * Returns the peak signal to noise ratio of the decoded image. The peak is
+ * the largest pixel value, 1 for floating point pixels.
+ *
+ * @returns the PSNR in dB, infinity for an exact tree, -1 if the tree has
+ * no image
+ *
+ *****************************************************************************/
+template <typename Pixel, typename Accum, int Size>
+double basicQuadTree<Pixel, Accum, Size>::psnr()
+{
+	const double peak = numeric_limits<Pixel>::is_integer ?
+		numeric_limits<Pixel>::max() : 1;
+	double error = mse();
+
+	if (error < 0)
+		return -1;
+	if (error == 0)
+		return numeric_limits<double>::infinity();
+	return 10 * log10(peak * peak / error);
+}
+
+ /**************************************************************************//**
+ * @par Description:
+ * Returns the sum of squared error of a leaf whose region is filled with
+ * its value v: the sum over the region of (p - v)^2, which is
+ * sq - 2 v sum + n v^2 with sum and sq taken from the integral images.
+ * This is exact for the stored value, rounding included.
+ *
+ * @param[in]      current - a pointer to the leaf
+ * @param[in]      rows - rows of the leaf's region
+ * @param[in]      cols - columns of the leaf's region
+ *
+ * @returns the sum of squared error of the leaf
+ *
+ *****************************************************************************/
+template <typename Pixel, typename Accum, int Size>
+double basicQuadTree<Pixel, Accum, Size>::leafError(Node *current, int rows,
+	int cols)
+{
+	const size_t width = size_t(Size != 0 ? Size : ncols) + 1;
+	int top = current->y;
+	int bottom = current->y - rows;
+	int left = current->x;
+	int right = current->x + cols;
+	double value = current->value;
+	double sum;
+	double sq;
+
+	sum = double(sumTable[top * width + right] - sumTable[bottom * width + right]
+		- sumTable[top * width + left] + sumTable[bottom * width + left]);
+	sq = double(sqTable[top * width + right] - sqTable[bottom * width + right]
+		- sqTable[top * width + left] + sqTable[bottom * width + left]);
+	return sq - 2 * value * sum + double(rows) * cols * value * value;
+}
+
+ /**************************************************************************//**
+ * @par Description:
+ * Returns the sum of squared error of the leaves below a node
+ *
+ * @param[in]      current - a pointer to the current node
+ *
+ * @returns the sum of squared error
+ *
+ *****************************************************************************/
+template <typename Pixel, typename Accum, int Size>
+double basicQuadTree<Pixel, Accum, Size>::treeError(Node *current)
+{
+	if (current->ul != nullptr)
+		return treeError(current->ul) + treeError(current->ur) +
+			treeError(current->ll) + treeError(current->lr);
+	return leafError(current, nrows >> current->level,
+		ncols >> current->level);
+}
+
+ /**************************************************************************//**
+ * @par Description:
+ * Builds the tables valueMatch uses from the image array. sumTable and
+ * sqTable are integral images: entry (r, c) holds the sum of the pixels (or
+ * squared pixels) in rows below r and columns left of c, so the sum of any
+ * rectangle takes four lookups. minTable and maxTable hold the smallest and
+ * largest pixel of every region the tree can produce, level by level, built
+ * from the finest level up by combining the four sub-regions. setImage only
+ * accepts sides that are powers of two, so the regions always form such a
+ * grid.
+ *
+ *****************************************************************************/
+template <typename Pixel, typename Accum, int Size>
+void basicQuadTree<Pixel, Accum, Size>::buildTables()
+{
+	//Variables, constants for a fixed size tree
+	const int height = Size != 0 ? Size : nrows;
+	const int stride = Size != 0 ? Size : ncols;
+	const size_t width = size_t(stride) + 1;
+	int level, side, rows, cols;
+	int i, j, r, c;
+	Pixel lo, hi, pixel;
+	Pixel *child;
+	STATS_START(statsStart);
+
+	//Tables of the same size as the last image are overwritten in place,
+	//otherwise throw them away and allocate new ones
+	if (tableRows != height || tableCols != stride)
+	{
+		freeTables();
+		sumTable = new Accum [(height + 1) * width]();
+		sqTable = new Accum [(height + 1) * width]();
+	}
+
+	//Build the integral images one row at a time from running row sums
+	for (i = 0; i < height; i++)
+	{
+		Accum rowSum = 0;
+		Accum rowSq = 0;
+		for (j = 0; j < stride; j++)
+		{
+			pixel = image[size_t(i) * stride + j];
+			rowSum += pixel;
+			rowSq += Accum(pixel) * pixel;
+			sumTable[(i + 1) * width + j + 1] = sumTable[i * width + j + 1]
+				+ rowSum;
+			sqTable[(i + 1) * width + j + 1] = sqTable[i * width + j + 1]
+				+ rowSq;
+		}
+	}
+
+	tableRows = height;
+	tableCols = stride;
+
+	//One level per halving until a region is a single row or column
+	if (minTable == nullptr)
+	{
+		tableLevels = 1;
+		while ((height >> tableLevels) > 0 && (stride >> tableLevels) > 0)
+			tableLevels++;
+		minTable = new Pixel* [tableLevels];
+		maxTable = new Pixel* [tableLevels];
+		for (level = 0; level < tableLevels; level++)
+		{
+			side = 1 << level;
+			minTable[level] = new Pixel [size_t(side) * side];
+			maxTable[level] = new Pixel [size_t(side) * side];
+		}
+	}
+
+	//Scan the pixels of every region on the finest level
+	level = tableLevels - 1;
+	side = 1 << level;
+	rows = height >> level;
+	cols = stride >> level;
+	for (r = 0; r < side; r++)
+	{
+		for (c = 0; c < side; c++)
+		{
+			lo = numeric_limits<Pixel>::max();
+			hi = numeric_limits<Pixel>::lowest();
+			for (i = r * rows; i < (r + 1) * rows; i++)
+			{
+				for (j = c * cols; j < (c + 1) * cols; j++)
+				{
+					pixel = image[size_t(i) * stride + j];
+					if (pixel < lo)
+						lo = pixel;
+					if (pixel > hi)
+						hi = pixel;
+				}
+			}
+			minTable[level][size_t(r) * side + c] = lo;
+			maxTable[level][size_t(r) * side + c] = hi;
+		}
+	}
+
+	//Every coarser region combines its four sub-regions on the level below
+	for (level = tableLevels - 2; level >= 0; level--)
+	{
+		side = 1 << level;
+		for (r = 0; r < side; r++)
+		{
+			for (c = 0; c < side; c++)
+			{
+				child = minTable[level + 1] + size_t(2 * r) * 2 * side + 2 * c;
+				lo = min(min(child[0], child[1]),
+					min(child[2 * side], child[2 * side + 1]));
+				child = maxTable[level + 1] + size_t(2 * r) * 2 * side + 2 * c;
+				hi = max(max(child[0], child[1]),
+					max(child[2 * side], child[2 * side + 1]));
+				minTable[level][size_t(r) * side + c] = lo;
+				maxTable[level][size_t(r) * side + c] = hi;
+			}
+		}
+	}
+
+	STATS_PHASE("tables", statsStart);
+}
+
+ /**************************************************************************//**
+ * @par Description:
+ * Frees the integral images and min/max tables built by buildTables.
+ * Called by the destructor and before building tables for a new image.
+ *
+ *****************************************************************************/
+template <typename Pixel, typename Accum, int Size>
+void basicQuadTree<Pixel, Accum, Size>::freeTables()
+{
+	int level;
+
+	delete [] sumTable;
+	delete [] sqTable;
+	for (level = 0; level < tableLevels; level++)
+	{
+		delete [] minTable[level];
+		delete [] maxTable[level];
+	}
+	delete [] minTable;
+	delete [] maxTable;
+
+	sumTable = nullptr;
+	sqTable = nullptr;
+	minTable = nullptr;
+	maxTable = nullptr;
+	tableLevels = 0;
+	tableRows = 0;
+	tableCols = 0;
+}
+
+ /**************************************************************************//**
+ * @par Description:
+ * Releases the nodes by traversing recursively, children first. Released
+ * nodes are kept on a free list for newNode to reuse and are deallocated
+ * by the destructor.
+ *
  * @param[in]      node - a pointer to the current node
- * 
+ *
+ *****************************************************************************/
+template <typename Pixel, typename Accum, int Size>
+void basicQuadTree<Pixel, Accum, Size>::deleteAll(Node *&node)
+{
+	if (node == nullptr)
+		return;
+
+	//Children are released first, deleteAll stops at the null children of
+	//leaves and of parents left half built by load
+	deleteAll(node->ur);
+	deleteAll(node->ul);
+	deleteAll(node->ll);
+	deleteAll(node->lr);
+
+	//Release a node after releasing all of its children
+	node->ul = freeNodes;
+	freeNodes = node;
+	freeCount++;
+	node = nullptr;
+}
+
+ /**************************************************************************//**
+ * @par Description:
+ * Empties the tree and deallocates the released nodes beyond keepNodes, so
+ * one large image does not leave a long running process (the encode
+ * server) holding the nodes of its tree for good. The tables are kept for
+ * the next image of the same size unless they cover more than keepNodes
+ * pixels, since they then take as much memory as the nodes.
+ *
+ * @param[in]      keepNodes - most released nodes to keep for reuse
+ *
  *****************************************************************************/
-void quadTree::deleteAll(Node *&node)
+template <typename Pixel, typename Accum, int Size>
+void basicQuadTree<Pixel, Accum, Size>::trim(unsigned int keepNodes)
 {
-	//Only traverses down if the node's children are not null
-	//Prevents seg fault and tells the function when to stop
-	if (node->ul != nullptr && node->ur != nullptr && node->lr != nullptr  && node->ll != nullptr)
+	Node *next;
+
+	deleteAll(root);
+	numNodes = 0;
+	numLeaves = 0;
+	sumSquaredError = 0;
+	errorKnown = false;
+
+	while (freeCount > keepNodes)
 	{
-		deleteAll(node->ur);
-		deleteAll(node->ul);
-		deleteAll(node->ll);
-		deleteAll(node->lr);
-		
+		next = freeNodes->ul;
+		delete freeNodes;
+		freeNodes = next;
+		freeCount--;
 	}
-	
-	//Delete a node after deleting all of its children
-	delete node;
+
+	if ((long long) tableRows * tableCols > keepNodes)
+		freeTables();
 }
+
+ /**************************************************************************//**
+ * @par Description:
+ * Groups adjacent leaves into regions of any shape, undoing the boundaries
+ * the power of two division puts between leaves of nearly the same value.
+ * Every pair of leaves sharing an edge is visited once, from the leaf on
+ * the left or below: the neighbour the same size or larger is found with
+ * locate, and when it is a parent the leaves along its facing edge are its
+ * neighbours. The regions are kept in a union-find structure with the sum
+ * and pixel count of each, and two regions are joined when their means are
+ * within the tolerance.
+ *
+ * The regions are numbered in the order their first leaf comes in a
+ * preorder walk of the tree, the order save writes the leaves in. The tree
+ * shape, the region of every leaf and the mean of every region are then
+ * enough to decode the segmented image, with one mean per region instead
+ * of one per leaf.
+ *
+ * @param[in]      tolerance - largest difference between the means of two
+ *                 regions that are joined
+ * @param[out]     regions - the mean and pixel count of every region
+ * @param[out]     labels - the region of every leaf, in preorder
+ * @param[out]     out - image array of nrows x ncols to fill with the mean
+ *                 of every pixel's region, or nullptr
+ *
+ * @returns the number of regions
+ *
+ *****************************************************************************/
+template <typename Pixel, typename Accum, int Size>
+unsigned int basicQuadTree<Pixel, Accum, Size>::segment(double tolerance,
+	vector<TreeRegion> &regions, vector<unsigned int> &labels, Pixel *out)
+{
+	const unsigned int unlabeled = numeric_limits<unsigned int>::max();
+	vector<Node *> leaves;
+	vector<Node *> neighbours;
+	unordered_map<Node *, unsigned int> index;
+	vector<unsigned int> parent;
+	vector<unsigned int> label;
+	vector<double> sum;
+	vector<double> count;
+	unsigned int i, j, a, b;
+	int rows, cols;
+	Node *leaf;
+
+	collectLeaves(root, leaves);
+	index.reserve(leaves.size());
+	parent.resize(leaves.size());
+	sum.resize(leaves.size());
+	count.resize(leaves.size());
+	for (i = 0; i < leaves.size(); i++)
+	{
+		leaf = leaves[i];
+		index[leaf] = i;
+		parent[i] = i;
+		count[i] = double(nrows >> leaf->level) * (ncols >> leaf->level);
+		sum[i] = leaf->value * count[i];
+	}
+
+	//Returns the region a leaf is in, halving the path on the way
+	auto find = [&](unsigned int k)
+	{
+		while (parent[k] != k)
+			k = parent[k] = parent[parent[k]];
+		return k;
+	};
+
+	for (i = 0; i < leaves.size(); i++)
+	{
+		leaf = leaves[i];
+		rows = nrows >> leaf->level;
+		cols = ncols >> leaf->level;
+
+		//Neighbours to the right, then above
+		neighbours.clear();
+		if (leaf->x + cols < ncols)
+			edgeLeaves(locate(leaf->y - 1, leaf->x + cols, leaf->level), true,
+				neighbours);
+		if (leaf->y < nrows)
+			edgeLeaves(locate(leaf->y, leaf->x, leaf->level), false,
+				neighbours);
+
+		for (j = 0; j < neighbours.size(); j++)
+		{
+			a = find(i);
+			b = find(index[neighbours[j]]);
+			if (a == b ||
+				fabs(sum[a] / count[a] - sum[b] / count[b]) > tolerance)
+				continue;
+
+			//The larger region absorbs the smaller one
+			if (count[a] < count[b])
+				swap(a, b);
+			parent[b] = a;
+			sum[a] += sum[b];
+			count[a] += count[b];
+		}
+	}
+
+	//Number the regions and label the leaves
+	regions.clear();
+	labels.resize(leaves.size());
+	label.assign(leaves.size(), unlabeled);
+	for (i = 0; i < leaves.size(); i++)
+	{
+		a = find(i);
+		if (label[a] == unlabeled)
+		{
+			label[a] = regions.size();
+			regions.push_back({sum[a] / count[a], (long long) count[a]});
+		}
+		labels[i] = label[a];
+	}
+
+	if (out != nullptr)
+	{
+		for (i = 0; i < leaves.size(); i++)
+		{
+			leaf = leaves[i];
+			rows = nrows >> leaf->level;
+			cols = ncols >> leaf->level;
+			for (j = 0; j < (unsigned int) rows; j++)
+				fill_n(out + size_t(j + leaf->y - rows) * ncols + leaf->x, cols,
+					toPixel(regions[labels[i]].mean));
+		}
+	}
+	return regions.size();
+}
+
+ /**************************************************************************//**
+ * @par Description:
+ * Appends the leaves below a node to a list, in preorder
+ *
+ * @param[in]      current - a pointer to the current node
+ * @param[in,out]  list - the list to append to
+ *
+ *****************************************************************************/
+template <typename Pixel, typename Accum, int Size>
+void basicQuadTree<Pixel, Accum, Size>::collectLeaves(Node *current,
+	vector<Node *> &list)
+{
+	if (current == nullptr)
+		return;
+
+	if (current->ul == nullptr)
+	{
+		list.push_back(current);
+		return;
+	}
+	collectLeaves(current->ul, list);
+	collectLeaves(current->ur, list);
+	collectLeaves(current->ll, list);
+	collectLeaves(current->lr, list);
+}
+
+ /**************************************************************************//**
+ * @par Description:
+ * Walks down from the root to the node covering a pixel, stopping at a
+ * leaf or at the given level. Regions on a level all have the same size
+ * and are aligned to it, so the node found for a pixel next to a leaf is
+ * the neighbour of the leaf that is the same size or larger.
+ *
+ * @param[in]      row - row of the pixel, 0 is the bottom row
+ * @param[in]      col - column of the pixel
+ * @param[in]      level - the deepest level to go to
+ *
+ * @returns the node covering the pixel
+ *
+ *****************************************************************************/
+template <typename Pixel, typename Accum, int Size>
+typename basicQuadTree<Pixel, Accum, Size>::Node *
+basicQuadTree<Pixel, Accum, Size>::locate(int row, int col, int level)
+{
+	Node *current = root;
+	bool upper;
+	bool right;
+
+	while (current->ul != nullptr && current->level < level)
+	{
+		upper = row >= current->y - (nrows >> (current->level + 1));
+		right = col >= current->x + (ncols >> (current->level + 1));
+		if (upper)
+			current = right ? current->ur : current->ul;
+		else
+			current = right ? current->lr : current->ll;
+	}
+	return current;
+}
+
+ /**************************************************************************//**
+ * @par Description:
+ * Appends the leaves below a node that touch its left edge, or its bottom
+ * edge. These are the leaves bordering a region to the left of or below
+ * the node.
+ *
+ * @param[in]      current - a pointer to the current node
+ * @param[in]      left - true for the left edge, false for the bottom edge
+ * @param[in,out]  list - the list to append to
+ *
+ *****************************************************************************/
+template <typename Pixel, typename Accum, int Size>
+void basicQuadTree<Pixel, Accum, Size>::edgeLeaves(Node *current, bool left,
+	vector<Node *> &list)
+{
+	if (current->ul == nullptr)
+	{
+		list.push_back(current);
+		return;
+	}
+	if (left)
+		edgeLeaves(current->ul, left, list);
+	edgeLeaves(current->ll, left, list);
+	if (!left)
+		edgeLeaves(current->lr, left, list);
+}
+
+ /**************************************************************************//**
+ * @par Description:
+ * Sets the hash of a node: for a leaf a hash of its value, for a parent a
+ * hash of its children's hashes in order. Positions and levels are left
+ * out, so two subtrees have the same hash when they decode to the same
+ * pixels in the same shape, wherever they are. Every function that builds
+ * or changes nodes calls this on the way back up, so the hashes are always
+ * current.
+ *
+ * @param[in,out]  current - a pointer to the node
+ *
+ *****************************************************************************/
+template <typename Pixel, typename Accum, int Size>
+void basicQuadTree<Pixel, Accum, Size>::hashNode(Node *current)
+{
+	//splitmix64 finalizer
+	auto mix = [](unsigned long long h)
+	{
+		h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+		return h ^ (h >> 31);
+	};
+	unsigned long long bits = 0;
+
+	if (current->ul == nullptr)
+	{
+		memcpy(&bits, &current->value, sizeof(current->value));
+		current->hash = mix(bits ^ 0x9e3779b97f4a7c15ULL);
+		return;
+	}
+	current->hash = mix(mix(mix(mix(current->ul->hash) ^ current->ur->hash) ^
+		current->ll->hash) ^ current->lr->hash);
+}
+
+ /**************************************************************************//**
+ * @par Description:
+ * Lists the rectangles where another tree built from an image of the same
+ * size decodes to different values than this one. Both trees are walked
+ * together and subtrees with equal hashes are skipped without being
+ * visited, so the work grows with the size of the change rather than the
+ * image. Where one tree has a leaf and the other divides further the leaf
+ * is compared with every piece, so the rectangles follow the finer of the
+ * two trees and each has a single delta.
+ *
+ * @param[in]      other - the tree to compare with
+ * @param[out]     changes - the changed rectangles, appended to
+ *
+ * @returns false if the trees are empty or of different sizes
+ *
+ *****************************************************************************/
+template <typename Pixel, typename Accum, int Size>
+bool basicQuadTree<Pixel, Accum, Size>::diff(basicQuadTree &other,
+	vector<TreeChange> &changes)
+{
+	if (root == nullptr || other.root == nullptr || nrows != other.nrows ||
+		ncols != other.ncols)
+		return false;
+
+	diffNode(root, other.root, 0, 0, nrows, changes);
+	return true;
+}
+
+ /**************************************************************************//**
+ * @par Description:
+ * Adds the changes between two nodes covering the same region. See diff.
+ *
+ * @param[in]      first - node of this tree
+ * @param[in]      second - node of the other tree
+ * @param[in]      level - the level of the tree we are currently at
+ * @param[in]      x - the x coordinate for our corner pixel
+ * @param[in]      y - the y coordinate for our corner pixel
+ * @param[out]     changes - the changed rectangles, appended to
+ *
+ *****************************************************************************/
+template <typename Pixel, typename Accum, int Size>
+void basicQuadTree<Pixel, Accum, Size>::diffNode(Node *first, Node *second,
+	int level, int x, int y, vector<TreeChange> &changes)
+{
+	int rows = nrows >> (level + 1);
+	int cols = ncols >> (level + 1);
+	TreeChange change;
+
+	if (first->hash == second->hash)
+		return;
+
+	if (first->ul == nullptr && second->ul == nullptr)
+	{
+		if (first->value == second->value)
+			return;
+		change.x = x;
+		change.y = y;
+		change.rows = nrows >> level;
+		change.cols = ncols >> level;
+		change.delta = double(second->value) - double(first->value);
+		changes.push_back(change);
+		return;
+	}
+
+	//A leaf stands in for all four of its pieces
+	diffNode(first->ul ? first->ul : first, second->ul ? second->ul : second,
+		level + 1, x, y, changes);
+	diffNode(first->ur ? first->ur : first, second->ur ? second->ur : second,
+		level + 1, x + cols, y, changes);
+	diffNode(first->ll ? first->ll : first, second->ll ? second->ll : second,
+		level + 1, x, y - rows, changes);
+	diffNode(first->lr ? first->lr : first, second->lr ? second->lr : second,
+		level + 1, x + cols, y - rows, changes);
+}
+
+ /**************************************************************************//**
+ * @par Description:
+ * Converts a computed value to a pixel. Integer pixels are rounded to the
+ * nearest value and clamped to the range of the pixel type.
+ *
+ * @param[in]      value - the value to convert
+ *
+ * @returns the value as a pixel
+ *
+ *****************************************************************************/
+template <typename Pixel, typename Accum, int Size>
+Pixel basicQuadTree<Pixel, Accum, Size>::toPixel(double value)
+{
+	if (!numeric_limits<Pixel>::is_integer)
+		return Pixel(value);
+	if (value <= 0)
+		return 0;
+	if (value >= numeric_limits<Pixel>::max())
+		return numeric_limits<Pixel>::max();
+	return Pixel(value + 0.5);
+}
+
+ /**************************************************************************//**
+ * @par Description:
+ * Applies a point operation to the value of every region directly in the
+ * tree, so the cost grows with the number of nodes rather than pixels.
+ * Sibling leaves the operation makes equal (a threshold, or values clamped
+ * at the ends of the range) are collapsed into their parent.
+ *   LINEAR    - value * a + b
+ *   THRESHOLD - b where value is at least a, 0 elsewhere
+ *
+ * @param[in]      op - the point operation
+ * @param[in]      a - first parameter of the operation
+ * @param[in]      b - second parameter of the operation
+ *
+ *****************************************************************************/
+template <typename Pixel, typename Accum, int Size>
+void basicQuadTree<Pixel, Accum, Size>::pointOp(PointOperation op, double a,
+	double b)
+{
+	mapNode(root, op, a, b);
+	errorKnown = false;
+}
+
+ /**************************************************************************//**
+ * @par Description:
+ * Applies a point operation to a node and all of its children. Leaves are
+ * mapped, parents take the mean of their mapped children and are collapsed
+ * if the children became equal leaves. See pointOp.
+ *
+ * @param[in,out]  current - a pointer to the current node
+ * @param[in]      op - the point operation
+ * @param[in]      a - first parameter of the operation
+ * @param[in]      b - second parameter of the operation
+ *
+ *****************************************************************************/
+template <typename Pixel, typename Accum, int Size>
+void basicQuadTree<Pixel, Accum, Size>::mapNode(Node *current,
+	PointOperation op, double a, double b)
+{
+	if (current == nullptr)
+		return;
+
+	if (current->ul != nullptr)
+	{
+		mapNode(current->ul, op, a, b);
+		mapNode(current->ur, op, a, b);
+		mapNode(current->ll, op, a, b);
+		mapNode(current->lr, op, a, b);
+		collapse(current);
+		return;
+	}
+
+	if (op == LINEAR)
+		current->value = toPixel(current->value * a + b);
+	else
+		current->value = toPixel(current->value >= a ? b : 0);
+	hashNode(current);
+}
+
+ /**************************************************************************//**
+ * @par Description:
+ * Replaces the tree with the combination of two trees built from images of
+ * the same size, working on the leaves rather than the pixels. The result
+ * divides a region wherever either tree does, so it has the union of their
+ * structure; where one tree has a leaf and the other divides further, the
+ * leaf's value is used for every piece. Sibling leaves that come out equal
+ * are collapsed into their parent. Either tree may be this tree.
+ *   BLEND      - first * (1 - weight) + second * weight
+ *   DIFFERENCE - |first - second|
+ *   MINIMUM    - smaller of first and second
+ *   MAXIMUM    - larger of first and second
+ *
+ * @param[in]      first - the first tree
+ * @param[in]      second - the second tree
+ * @param[in]      op - how to combine the values
+ * @param[in]      weight - weight of the second tree for BLEND
+ *
+ * @returns false if the trees are empty or of different sizes
+ *
+ *****************************************************************************/
+template <typename Pixel, typename Accum, int Size>
+bool basicQuadTree<Pixel, Accum, Size>::merge(basicQuadTree &first,
+	basicQuadTree &second, MergeOperation op, double weight)
+{
+	Node *result;
+	int rows = first.nrows;
+	int cols = first.ncols;
+
+	if (first.root == nullptr || second.root == nullptr ||
+		rows != second.nrows || cols != second.ncols)
+		return false;
+
+	//Count the nodes of the result, then swap it in for the old tree. The
+	//result was not built from an image, so it has no error to measure.
+	numNodes = 0;
+	numLeaves = 0;
+	nrows = rows;
+	ncols = cols;
+	image = nullptr;
+	errorKnown = false;
+	result = mergeNode(first.root, second.root, 0, 0, rows, op, weight);
+	deleteAll(root);
+	root = result;
+	return true;
+}
+
+ /**************************************************************************//**
+ * @par Description:
+ * Builds the merge of two nodes covering the same region. See merge.
+ *
+ * @param[in]      first - node of the first tree
+ * @param[in]      second - node of the second tree
+ * @param[in]      level - the level of the tree we are currently at
+ * @param[in]      x - the x coordinate for our corner pixel
+ * @param[in]      y - the y coordinate for our corner pixel
+ * @param[in]      op - how to combine the values
+ * @param[in]      weight - weight of the second tree for BLEND
+ *
+ * @returns the new node
+ *
+ *****************************************************************************/
+template <typename Pixel, typename Accum, int Size>
+typename basicQuadTree<Pixel, Accum, Size>::Node *
+basicQuadTree<Pixel, Accum, Size>::mergeNode(Node *first, Node *second,
+	int level, int x, int y, MergeOperation op, double weight)
+{
+	Node *current = newNode();
+	int rows = nrows >> (level + 1);
+	int cols = ncols >> (level + 1);
+	double v1 = first->value;
+	double v2 = second->value;
+
+	numNodes++;
+	current->x = x;
+	current->y = y;
+	current->level = level;
+
+	//Both regions are uniform, so the result is too
+	if (first->ul == nullptr && second->ul == nullptr)
+	{
+		numLeaves++;
+		if (op == BLEND)
+			current->value = toPixel(v1 * (1 - weight) + v2 * weight);
+		else if (op == DIFFERENCE)
+			current->value = toPixel(v1 > v2 ? v1 - v2 : v2 - v1);
+		else if (op == MINIMUM)
+			current->value = toPixel(min(v1, v2));
+		else
+			current->value = toPixel(max(v1, v2));
+		hashNode(current);
+		return current;
+	}
+
+	//A leaf stands in for all four of its pieces
+	current->ul = mergeNode(first->ul ? first->ul : first,
+		second->ul ? second->ul : second, level + 1, x, y, op, weight);
+	current->ur = mergeNode(first->ur ? first->ur : first,
+		second->ur ? second->ur : second, level + 1, x + cols, y, op, weight);
+	current->ll = mergeNode(first->ll ? first->ll : first,
+		second->ll ? second->ll : second, level + 1, x, y - rows, op, weight);
+	current->lr = mergeNode(first->lr ? first->lr : first,
+		second->lr ? second->lr : second, level + 1, x + cols, y - rows, op,
+		weight);
+	collapse(current);
+	return current;
+}
+
+ /**************************************************************************//**
+ * @par Description:
+ * Sets a parent's value to the mean of its children, and if the children
+ * are leaves with equal values releases them so the parent becomes a leaf.
+ * The parent's hash is updated either way.
+ *
+ * @param[in,out]  current - a pointer to a parent node
+ *
+ *****************************************************************************/
+template <typename Pixel, typename Accum, int Size>
+void basicQuadTree<Pixel, Accum, Size>::collapse(Node *current)
+{
+	Node *ul = current->ul;
+	Node *ur = current->ur;
+	Node *ll = current->ll;
+	Node *lr = current->lr;
+
+	current->value = Pixel((Accum(ul->value) + ur->value + ll->value +
+		lr->value) / 4);
+
+	if (ul->ul == nullptr && ur->ul == nullptr && ll->ul == nullptr &&
+		lr->ul == nullptr && ul->value == ur->value &&
+		ul->value == ll->value && ul->value == lr->value)
+	{
+		current->value = ul->value;
+		deleteAll(current->ul);
+		deleteAll(current->ur);
+		deleteAll(current->ll);
+		deleteAll(current->lr);
+		numNodes -= 4;
+		numLeaves -= 3;
+	}
+	hashNode(current);
+}
+
+ /**************************************************************************//**
+ * @par Description:
+ * Writes the tree to a file: a "QTR2" tag, the image rows and columns and
+ * the size of a pixel in bytes, then every node in preorder (ul, ur, ll, lr)
+ * as one byte, 0 for a parent and 1 for a leaf, with each leaf followed by
+ * its value. Positions and levels are not stored since they follow from the
+ * order of the nodes.
+ *
+ * @param[in]      fout - the file to write to
+ *
+ * @returns true if the tree was written, false otherwise
+ *
+ *****************************************************************************/
+template <typename Pixel, typename Accum, int Size>
+bool basicQuadTree<Pixel, Accum, Size>::save(FILE *fout)
+{
+	int dims[3] = {nrows, ncols, (int) sizeof(Pixel)};
+
+	if (root == nullptr)
+		return false;
+	if (fwrite("QTR2", 1, 4, fout) != 4 || fwrite(dims, sizeof(int), 3, fout) != 3)
+		return false;
+	return saveNode(root, fout);
+}
+
+ /**************************************************************************//**
+ * @par Description:
+ * Writes a node and all of its children in preorder. See save.
+ *
+ * @param[in]      current - a pointer to the current node
+ * @param[in]      fout - the file to write to
+ *
+ * @returns true if the nodes were written, false otherwise
+ *
+ *****************************************************************************/
+template <typename Pixel, typename Accum, int Size>
+bool basicQuadTree<Pixel, Accum, Size>::saveNode(Node *current, FILE *fout)
+{
+	if (current->ul != nullptr)
+	{
+		return fputc(0, fout) != EOF && saveNode(current->ul, fout) &&
+			saveNode(current->ur, fout) && saveNode(current->ll, fout) &&
+			saveNode(current->lr, fout);
+	}
+	return fputc(1, fout) != EOF &&
+		fwrite(&current->value, sizeof(current->value), 1, fout) == 1;
+}
+
+ /**************************************************************************//**
+ * @par Description:
+ * Replaces the tree with one read from a file written by save. The image
+ * the tree was built from must have the same rows and columns as the
+ * image currently set, and the same pixel size.
+ *
+ * @param[in]      fin - the file to read from
+ *
+ * @returns true if a tree was read, false otherwise
+ *
+ *****************************************************************************/
+template <typename Pixel, typename Accum, int Size>
+bool basicQuadTree<Pixel, Accum, Size>::load(FILE *fin)
+{
+	char tag[4];
+	int dims[3];
+
+	if (fread(tag, 1, 4, fin) != 4 || fread(dims, sizeof(int), 3, fin) != 3)
+		return false;
+	if (memcmp(tag, "QTR2", 4) != 0 || dims[0] != nrows || dims[1] != ncols ||
+		dims[2] != (int) sizeof(Pixel))
+		return false;
+
+	deleteAll(root);
+	numNodes = 0;
+	numLeaves = 0;
+	errorKnown = false;
+	if (!loadNode(root, 0, 0, nrows, fin))
+	{
+		deleteAll(root);
+		return false;
+	}
+	return true;
+}
+
+ /**************************************************************************//**
+ * @par Description:
+ * Reads a node and all of its children in preorder, setting their
+ * positions and levels the same way fillTree does. See save. The value of
+ * a parent is set to the mean of its children.
+ *
+ * @param[in,out]      current - a pointer to the current node
+ * @param[in]          level - the level of the tree we are currently at
+ * @param[in]          x - the x coordinate for our corner pixel
+ * @param[in]          y - the y coordinate for our corner pixel
+ * @param[in]          fin - the file to read from
+ *
+ * @returns true if the nodes were read, false otherwise
+ *
+ *****************************************************************************/
+template <typename Pixel, typename Accum, int Size>
+bool basicQuadTree<Pixel, Accum, Size>::loadNode(Node *&current, int level,
+	int x, int y, FILE *fin)
+{
+	int tag = fgetc(fin);
+	int rows = nrows >> (level + 1);
+	int cols = ncols >> (level + 1);
+
+	if (tag != 0 && tag != 1)
+		return false;
+
+	current = newNode();
+	current->x = x;
+	current->y = y;
+	current->level = level;
+	numNodes++;
+
+	if (tag == 1)
+	{
+		numLeaves++;
+		if (fread(&current->value, sizeof(current->value), 1, fin) != 1)
+			return false;
+		hashNode(current);
+		return true;
+	}
+
+	//A parent that cannot be divided any further means a corrupt file
+	if (rows == 0 || cols == 0)
+		return false;
+	if (!loadNode(current->ul, level + 1, x, y, fin) ||
+		!loadNode(current->ur, level + 1, x + cols, y, fin) ||
+		!loadNode(current->ll, level + 1, x, y - rows, fin) ||
+		!loadNode(current->lr, level + 1, x + cols, y - rows, fin))
+		return false;
+
+	current->value = Pixel((Accum(current->ul->value) + current->ur->value +
+		current->ll->value + current->lr->value) / 4);
+	hashNode(current);
+	return true;
+}
+
+ /**************************************************************************//**
+ * @par Description:
+ * Writes the tree segmented with the given tolerance (see segment): a
+ * "QTS1" tag, the image rows and columns and the size of a pixel in bytes,
+ * the number of regions and the number of bytes of bits, the mean of every
+ * region as a pixel, then one stream of bits. The stream holds every node
+ * in preorder (ul, ur, ll, lr) as one bit, 1 for a parent and 0 for a leaf,
+ * with each leaf followed by its region number in just enough bits to tell
+ * the regions apart. A leaf then costs a bit plus the bits of its region
+ * number instead of the byte of its tag and the bytes of its value, and
+ * each value is stored once per region. This is smaller than save when
+ * there are many fewer regions than leaves; with about as many, the region
+ * numbers get as wide as the values and the means are stored twice over.
+ *
+ * @param[in]      fout - the file to write to
+ * @param[in]      tolerance - largest difference between the means of two
+ *                 regions that are joined
+ *
+ * @returns true if the tree was written, false otherwise
+ *
+ *****************************************************************************/
+template <typename Pixel, typename Accum, int Size>
+bool basicQuadTree<Pixel, Accum, Size>::saveSegmented(FILE *fout,
+	double tolerance)
+{
+	int dims[3] = {nrows, ncols, (int) sizeof(Pixel)};
+	uint32_t counts[2];
+	vector<TreeRegion> regions;
+	vector<unsigned int> labels;
+	vector<Pixel> means;
+	vector<unsigned char> bits;
+	vector<Node *> stack;
+	size_t bitCount = 0;
+	size_t leaf = 0;
+	size_t i;
+	int width = 0;
+	Node *current;
+
+	//Appends the low count bits of value to the stream, high bit first
+	auto put = [&](unsigned int value, int count)
+	{
+		while (count-- > 0)
+		{
+			if (bitCount % 8 == 0)
+				bits.push_back(0);
+			if ((value >> count) & 1)
+				bits.back() |= 0x80 >> (bitCount % 8);
+			bitCount++;
+		}
+	};
+
+	if (root == nullptr)
+		return false;
+	segment(tolerance, regions, labels, nullptr);
+	while ((1ull << width) < regions.size())
+		width++;
+
+	//Preorder walk, pushing the children in reverse so ul comes out first
+	stack.push_back(root);
+	while (!stack.empty())
+	{
+		current = stack.back();
+		stack.pop_back();
+		if (current->ul != nullptr)
+		{
+			put(1, 1);
+			stack.push_back(current->lr);
+			stack.push_back(current->ll);
+			stack.push_back(current->ur);
+			stack.push_back(current->ul);
+		}
+		else
+		{
+			put(0, 1);
+			put(labels[leaf++], width);
+		}
+	}
+
+	means.resize(regions.size());
+	for (i = 0; i < regions.size(); i++)
+		means[i] = toPixel(regions[i].mean);
+	counts[0] = regions.size();
+	counts[1] = bits.size();
+	return fwrite("QTS1", 1, 4, fout) == 4 &&
+		fwrite(dims, sizeof(int), 3, fout) == 3 &&
+		fwrite(counts, sizeof(uint32_t), 2, fout) == 2 &&
+		fwrite(means.data(), sizeof(Pixel), means.size(), fout) ==
+			means.size() &&
+		fwrite(bits.data(), 1, bits.size(), fout) == bits.size();
+}
+
+ /**************************************************************************//**
+ * @par Description:
+ * Replaces the tree with one read from a file written by saveSegmented.
+ * Every leaf gets the mean of its region, so the tree decodes to the image
+ * segment paints. The image the tree was built from must have the same
+ * rows and columns as the image currently set, and the same pixel size.
+ *
+ * @param[in]      fin - the file to read from
+ *
+ * @returns true if a tree was read, false otherwise
+ *
+ *****************************************************************************/
+template <typename Pixel, typename Accum, int Size>
+bool basicQuadTree<Pixel, Accum, Size>::loadSegmented(FILE *fin)
+{
+	char tag[4];
+	int dims[3];
+	uint32_t counts[2];
+	vector<Pixel> means;
+	vector<unsigned char> bits;
+	size_t pos = 0;
+	int width = 0;
+
+	if (fread(tag, 1, 4, fin) != 4 || fread(dims, sizeof(int), 3, fin) != 3 ||
+		fread(counts, sizeof(uint32_t), 2, fin) != 2)
+		return false;
+	if (memcmp(tag, "QTS1", 4) != 0 || dims[0] != nrows || dims[1] != ncols ||
+		dims[2] != (int) sizeof(Pixel) || counts[0] == 0 ||
+		counts[0] > (unsigned long long) nrows * ncols ||
+		counts[1] > (unsigned long long) nrows * ncols * 8)
+		return false;
+
+	means.resize(counts[0]);
+	bits.resize(counts[1]);
+	if (fread(means.data(), sizeof(Pixel), means.size(), fin) != means.size() ||
+		fread(bits.data(), 1, bits.size(), fin) != bits.size())
+		return false;
+	while ((1ull << width) < means.size())
+		width++;
+
+	deleteAll(root);
+	numNodes = 0;
+	numLeaves = 0;
+	errorKnown = false;
+	if (!loadRegionNode(root, 0, 0, nrows, bits, pos, width, means))
+	{
+		deleteAll(root);
+		return false;
+	}
+	return true;
+}
+
+ /**************************************************************************//**
+ * @par Description:
+ * Builds a node and all of its children from the bit stream written by
+ * saveSegmented, setting their positions and levels the same way fillTree
+ * does. The value of a parent is set to the mean of its children.
+ *
+ * @param[in,out]      current - a pointer to the current node
+ * @param[in]          level - the level of the tree we are currently at
+ * @param[in]          x - the x coordinate for our corner pixel
+ * @param[in]          y - the y coordinate for our corner pixel
+ * @param[in]          bits - the bit stream
+ * @param[in,out]      pos - the next bit to read
+ * @param[in]          width - bits in a region number
+ * @param[in]          means - the mean of every region
+ *
+ * @returns true if the nodes were read, false otherwise
+ *
+ *****************************************************************************/
+template <typename Pixel, typename Accum, int Size>
+bool basicQuadTree<Pixel, Accum, Size>::loadRegionNode(Node *&current,
+	int level, int x, int y, const vector<unsigned char> &bits, size_t &pos,
+	int width, const vector<Pixel> &means)
+{
+	int rows = nrows >> (level + 1);
+	int cols = ncols >> (level + 1);
+	unsigned int label = 0;
+	bool parent;
+	int k;
+
+	if (pos >= bits.size() * 8)
+		return false;
+	parent = (bits[pos / 8] >> (7 - pos % 8)) & 1;
+	pos++;
+
+	current = newNode();
+	current->x = x;
+	current->y = y;
+	current->level = level;
+	numNodes++;
+
+	if (!parent)
+	{
+		numLeaves++;
+		if (pos + width > bits.size() * 8)
+			return false;
+		for (k = 0; k < width; k++, pos++)
+			label = label << 1 | ((bits[pos / 8] >> (7 - pos % 8)) & 1);
+		if (label >= means.size())
+			return false;
+		current->value = means[label];
+		hashNode(current);
+		return true;
+	}
+
+	//A parent that cannot be divided any further means a corrupt file
+	if (rows == 0 || cols == 0)
+		return false;
+	if (!loadRegionNode(current->ul, level + 1, x, y, bits, pos, width,
+			means) ||
+		!loadRegionNode(current->ur, level + 1, x + cols, y, bits, pos, width,
+			means) ||
+		!loadRegionNode(current->ll, level + 1, x, y - rows, bits, pos, width,
+			means) ||
+		!loadRegionNode(current->lr, level + 1, x + cols, y - rows, bits, pos,
+			width, means))
+		return false;
+
+	current->value = Pixel((Accum(current->ul->value) + current->ur->value +
+		current->ll->value + current->lr->value) / 4);
+	hashNode(current);
+	return true;
+}
+
+ /**************************************************************************//**
+ * @par Description:
+ * Writes the tree in the layout read by flatTree: a FlatHeader, the index
+ * of the first child of every node (0 for a leaf) and the value of every
+ * node. The nodes are numbered level by level so the four children of a
+ * parent get consecutive indices, and a parent's value is the mean of its
+ * region so the file can be drawn at any level of detail.
+ *
+ * @param[in]      fout - the file to write to
+ *
+ * @returns true if the tree was written, false otherwise
+ *
+ *****************************************************************************/
+template <typename Pixel, typename Accum, int Size>
+bool basicQuadTree<Pixel, Accum, Size>::saveFlat(FILE *fout)
+{
+	vector<Node *> order;
+	vector<uint32_t> children;
+	vector<Pixel> values;
+	FlatHeader header;
+	static const char padding[8] = {0};
+	size_t pad;
+	size_t i;
+
+	if (root == nullptr)
+		return false;
+
+	//Level order: a node's children are appended together when it is reached
+	order.reserve(numNodes);
+	order.push_back(root);
+	for (i = 0; i < order.size(); i++)
+	{
+		if (order[i]->ul == nullptr)
+		{
+			children.push_back(0);
+		}
+		else
+		{
+			children.push_back(order.size());
+			order.push_back(order[i]->ul);
+			order.push_back(order[i]->ur);
+			order.push_back(order[i]->ll);
+			order.push_back(order[i]->lr);
+		}
+		values.push_back(order[i]->value);
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.tag, "QTF1", 4);
+	header.rows = nrows;
+	header.cols = ncols;
+	header.pixelSize = sizeof(Pixel);
+	header.nodes = order.size();
+	header.leaves = count(children.begin(), children.end(), 0u);
+	header.valueOffset = flatValueOffset(header.nodes);
+	pad = header.valueOffset - sizeof(header) - 4 * children.size();
+
+	return fwrite(&header, sizeof(header), 1, fout) == 1 &&
+		fwrite(children.data(), 4, children.size(), fout) == children.size() &&
+		fwrite(padding, 1, pad, fout) == pad &&
+		fwrite(values.data(), sizeof(Pixel), values.size(), fout) ==
+			values.size();
+}
+
+ /**************************************************************************//**
+ * @par Description:
+ * Converts the criterion name given on the command line to a SplitCriterion
+ *
+ * @param[in]    name - the criterion name: max, variance or sse
+ * @param[out]   crit - the matching split criterion
+ *
+ * @returns true if the name was recognized, false otherwise
+ *
+ *****************************************************************************/
+bool parseCriterion(const char *name, SplitCriterion &crit)
+{
+	if (strcmp(name, "max") == 0)
+		crit = MAX_DEVIATION;
+	else if (strcmp(name, "variance") == 0)
+		crit = VARIANCE;
+	else if (strcmp(name, "sse") == 0)
+		crit = SSE_BUDGET;
+	else
+		return false;
+	return true;
+}
+
+//The pixel types, accumulators and fixed sizes the programs can use
+template class basicQuadTree<unsigned char, unsigned long long>;
+template class basicQuadTree<unsigned char, unsigned long long, 512>;
+template class basicQuadTree<unsigned char, unsigned long long, 4096>;
+template class basicQuadTree<unsigned short, unsigned long long>;
+template class basicQuadTree<unsigned short, unsigned long long, 512>;
+template class basicQuadTree<unsigned short, unsigned long long, 4096>;
+template class basicQuadTree<float, double>;
+template class basicQuadTree<float, double, 512>;
+template class basicQuadTree<float, double, 4096>;
@@ -1,13 +1,21 @@
 /**
  *  @file
- *	
+ *
  *	@brief The quadtree class contains a quad tree built from a bitmap image.
- *  The tree class recursively divides the image into 4 pieces until all of 
+ *  The tree class recursively divides the image into 4 pieces until all of
  *  the pixels inside of a quadrant are within a certain tolerance of the mean
  *  of that area. This class also provides a function to draw an overlay of the
  *  sub-quadrants over the compressed image to show the lines of division.
- * 
- *  @class quadTree
+ *
+ *  The class is a template over the pixel type (unsigned char for 8-bit
+ *  images, unsigned short for 12/16-bit images, float), the type used to
+ *  accumulate sums of pixels and squared pixels, and optionally a fixed
+ *  image size. With a fixed size (512 or 4096) the region sizes, strides and
+ *  loop bounds of every level are compile-time constants. The definitions are
+ *  in quadTree.cpp, which instantiates the supported combinations; quadTree
+ *  is the 8-bit tree used by the programs.
+ *
+ *  @class basicQuadTree
  *
  *	@author Chris Hjelmfelt
  *	@author Cheldon Coughlen
@@ -17,71 +25,349 @@
 #ifndef _quad_Tree_
 #define _quad_Tree_
 
+#include <cstdio>
+#include <type_traits>
+#include <vector>
+
+///Criteria valueMatch can use to decide if a region must be divided
+enum SplitCriterion
+{
+	///Divide if any pixel is more than fudge away from the mean
+	MAX_DEVIATION,
+
+	///Divide if the variance of the region is more than fudge squared
+	VARIANCE,
+
+	///Divide if the sum of squared error of the region is more than fudge
+	SSE_BUDGET
+};
+
+///Point operations pointOp can apply to the value of every region
+enum PointOperation
+{
+	///value * a + b, for brightness and contrast
+	LINEAR,
+
+	///b where value is at least a, 0 elsewhere
+	THRESHOLD
+};
+
+///Ways merge can combine the values of two trees
+enum MergeOperation
+{
+	///first * (1 - weight) + second * weight
+	BLEND,
+
+	///|first - second|
+	DIFFERENCE,
+
+	///smaller of first and second
+	MINIMUM,
+
+	///larger of first and second
+	MAXIMUM
+};
+
+///A rectangle where two trees decode to different values, see diff
+struct TreeChange
+{
+	///Left column and the row above the top of the rectangle, like Node
+	int x;
+	int y;
+
+	///Size of the rectangle
+	int rows;
+	int cols;
+
+	///Value in the second tree minus value in the first
+	double delta;
+};
+
+///Adjacent leaves joined into one region, see segment
+struct TreeRegion
+{
+	///Mean of the pixels in the region
+	double mean;
+
+	///Number of pixels in the region
+	long long pixels;
+};
+
+///Converts a criterion name (max, variance or sse) to a SplitCriterion
+bool parseCriterion(const char *name, SplitCriterion &crit);
+
+///Number of times size can be halved before reaching 1, 0 for size 0
+constexpr int levelsBelow(int size)
+{
+	return size > 1 ? 1 + levelsBelow(size / 2) : 0;
+}
+
+///True if n is a positive power of two, the only image sides fillTree
+///can divide evenly down to single pixels
+constexpr bool powerOfTwo(int n)
+{
+	return n > 0 && (n & (n - 1)) == 0;
+}
+
 //quadTree class interface
-class quadTree
+template <typename Pixel, typename Accum, int Size = 0>
+class basicQuadTree
 {
 	private:
 		///Structure to hold a region of a quadtree
 		struct Node
 		{
-			///Value of a region, defaulted to -1
-			short int value = -1;
-		
+			///Mean value of the region
+			Pixel value = 0;
+
 			///Holds the level of the current leaf, useful for printing overlay
 			int level = 0;
-		
+
 			///Integer to hold x location of the upper left hand corner
 			int x;
-		
+
 			///Integer to hold the y location of the upper left hand corner
 			int y;
-		
+
+			///Hash of the shape and values of the subtree, see hashNode
+			unsigned long long hash = 0;
+
 			///Upper right quad
-			Node *ur;
-			
-			///Upper left quad
-			Node *ul;
-		
+			Node *ur = nullptr;
+
+			///Upper left quad, nullptr for a leaf
+			Node *ul = nullptr;
+
 			///Lower left quad
-			Node *ll;
-		
+			Node *ll = nullptr;
+
 			///Lower right quad
-			Node *lr;
+			Node *lr = nullptr;
 		};
-	
-	
+
+		///Deepest level of a fixed size tree, where regions are one pixel
+		static const int maxLevel = levelsBelow(Size);
+
 		///Counter for the leaves in the tree
 		unsigned int numLeaves = 0;
-		
+
 		///Counter for the nodes in the tree
 		unsigned int numNodes = 0;
+
+		///Monochrome image the tree is built from, nrows x ncols
+		const Pixel *image = nullptr;
+
+		///Image dimensions in rows
+		int nrows = Size;
+
+		///Image dimensions in columns
+		int ncols = Size;
+
+		///Quality factor
+		double fudge = 0;
+
+		///Test used to decide when a region is divided
+		SplitCriterion criterion = MAX_DEVIATION;
+
+		///Rows and columns the tables were allocated for
+		int tableRows = 0;
+		int tableCols = 0;
+
+		///Sum of squared error of the leaves against the image
+		double sumSquaredError = 0;
+
+		///Whether sumSquaredError is up to date with the leaves
+		bool errorKnown = false;
+
+		///Nodes released by deleteAll, kept to be reused by the next tree
+		Node *freeNodes = nullptr;
+
+		///Number of nodes on freeNodes
+		unsigned int freeCount = 0;
+
+		///Returns a fresh node, reusing a released one when there is one
+		Node *newNode();
+
+		///Integral image of the pixel values, (nrows + 1) x (ncols + 1)
+		Accum *sumTable = nullptr;
+
+		///Integral image of the squared pixel values, same layout as sumTable
+		Accum *sqTable = nullptr;
+
+		///Minimum pixel of every region, one array per level of the tree
+		Pixel **minTable = nullptr;
+
+		///Maximum pixel of every region, one array per level of the tree
+		Pixel **maxTable = nullptr;
+
+		///Number of levels held in minTable and maxTable
+		int tableLevels = 0;
+
+		///Builds the integral images and min/max tables from the image
+		void buildTables();
+
+		///Frees the integral images and min/max tables
+		void freeTables();
+
+		///Fills a fixed size tree from the given level down
+		template <int Level>
+		void fillLevel(Node *&current, int x, int y,
+			std::integral_constant<int, Level>);
+
+		///Ends the recursion of fillLevel below the deepest level
+		void fillLevel(Node *&current, int x, int y,
+			std::integral_constant<int, maxLevel + 1>);
+
+		///Decodes a fixed size tree from the given level down
+		template <int Level>
+		void decodeLevel(Node *current, Pixel *out,
+			std::integral_constant<int, Level>);
+
+		///Ends the recursion of decodeLevel below the deepest level
+		void decodeLevel(Node *current, Pixel *out,
+			std::integral_constant<int, maxLevel + 1>);
+
+		///Returns the sum of squared error of a leaf from the tables
+		double leafError(Node *current, int rows, int cols);
+
+		///Returns the sum of squared error of the leaves below a node
+		double treeError(Node *current);
+
+		///Returns the first screen pixel whose center is at or past pos
+		static int screenIndex(double pos, double origin, double scale,
+			int count);
+
+		///Appends the leaves below a node to a list
+		void collectLeaves(Node *current, std::vector<Node *> &list);
+
+		///Returns the deepest node no deeper than level covering a pixel
+		Node *locate(int row, int col, int level);
+
+		///Appends the leaves along the left or bottom edge of a node
+		void edgeLeaves(Node *current, bool left, std::vector<Node *> &list);
+
+		///Sets a node's hash from its value or its children's hashes
+		void hashNode(Node *current);
+
+		///Adds the changes between two nodes covering the same region
+		void diffNode(Node *first, Node *second, int level, int x, int y,
+			std::vector<TreeChange> &changes);
+
+		///Converts a computed value to a pixel, rounded and clamped
+		Pixel toPixel(double value);
+
+		///Applies a point operation to a node and its children
+		void mapNode(Node *current, PointOperation op, double a, double b);
+
+		///Builds the merge of two nodes covering the same region
+		Node *mergeNode(Node *first, Node *second, int level, int x, int y,
+			MergeOperation op, double weight);
+
+		///Turns a parent whose children are equal leaves into a leaf
+		void collapse(Node *current);
+
+		///Writes a node and its children to a file in preorder
+		bool saveNode(Node *current, FILE *fout);
+
+		///Reads a node and its children from a file written by saveNode
+		bool loadNode(Node *&current, int level, int x, int y, FILE *fin);
+
+		///Builds a node and its children from the bits of saveSegmented
+		bool loadRegionNode(Node *&current, int level, int x, int y,
+			const std::vector<unsigned char> &bits, size_t &pos, int width,
+			const std::vector<Pixel> &means);
 	public:
 		///Pointer to the root of the tree
 		Node *root;
-	
+
 		///Constructor
-		quadTree();
-	
+		basicQuadTree();
+
 		///Destructor
-		~quadTree();
-	
+		~basicQuadTree();
+
+		///Sets the image, fudge factor and criterion the tree is built with
+		bool setImage(const Pixel *pixels, int rows, int cols,
+			double factor, SplitCriterion crit);
+
 		///Fills the tree recursively, calling valueMatch to check values
 		void fillTree(Node*& current, int level, int x, int y);
-	
-		///Draw tree lines overlay 
-		void printTree( Node* current, int level);
-	
+
+		///Writes the mean of every leaf into an image array
+		void decode(Node* current, Pixel* out);
+
+		///Draws the visible part of the tree at screen resolution
+		void render(Node *current, Pixel *out, int outRows, int outCols,
+			double left, double bottom, double scale, bool outline);
+
 		///Return the number of leaves
-		unsigned int leaves();	
-		
+		unsigned int leaves();
+
 		///Returns the number of nodes
 		unsigned int nodes();
-	
-		///Checks for the values within the fudge factor, returns mean
-		int valueMatch(Node *current);
-	
-		///Frees memory by traversing recursively
+
+		///Returns the sum of squared error of the decoded image
+		double squaredError();
+
+		///Returns the mean squared error of the decoded image
+		double mse();
+
+		///Returns the peak signal to noise ratio of the decoded image in dB
+		double psnr();
+
+		///Sets the region's mean, returns true if it need not be divided
+		bool valueMatch(Node *current, int rows, int cols);
+
+		///Releases the nodes by traversing recursively
 		void deleteAll(Node *&node);
+
+		///Empties the tree and gives back memory kept for the next one
+		void trim(unsigned int keepNodes);
+
+		///Groups adjacent leaves with similar means into regions
+		unsigned int segment(double tolerance, std::vector<TreeRegion> &regions,
+			std::vector<unsigned int> &labels, Pixel *out);
+
+		///Applies a point operation to every region without decoding
+		void pointOp(PointOperation op, double a, double b);
+
+		///Replaces the tree with the combination of two trees, leaf by leaf
+		bool merge(basicQuadTree &first, basicQuadTree &second,
+			MergeOperation op, double weight);
+
+		///Lists the rectangles where another tree decodes differently
+		bool diff(basicQuadTree &other, std::vector<TreeChange> &changes);
+
+		///Writes the tree to a file
+		bool save(FILE *fout);
+
+		///Replaces the tree with one read from a file written by save
+		bool load(FILE *fin);
+
+		///Writes the tree in the layout flatTree maps without loading
+		bool saveFlat(FILE *fout);
+
+		///Writes the segmented tree: its shape, the region of every leaf and
+		///one mean per region
+		bool saveSegmented(FILE *fout, double tolerance);
+
+		///Replaces the tree with one read from a file written by saveSegmented
+		bool loadSegmented(FILE *fin);
 };
 
+///The 8-bit tree used by the viewer, benchmark and server
+typedef basicQuadTree<unsigned char, unsigned long long> quadTree;
+
+///8-bit tree specialized for 512 x 512 images
+typedef basicQuadTree<unsigned char, unsigned long long, 512> quadTree512;
+
+///8-bit tree specialized for 4096 x 4096 images
+typedef basicQuadTree<unsigned char, unsigned long long, 4096> quadTree4096;
+
+///Tree for 12 and 16-bit images
+typedef basicQuadTree<unsigned short, unsigned long long> quadTree16;
+
+///Tree for floating point images
+typedef basicQuadTree<float, double> quadTreeFloat;
+
 #endif
@@ -0,0 +1,198 @@
+/**************************************************************************//**
+ * @file
+ * @brief Structural similarity (SSIM) of two monochrome images
+ *
+ * The images are cut into 4 x 4 blocks and the SSIM of every 8 x 8 window
+ * made of 2 x 2 blocks is averaged, so windows overlap by half. For each
+ * block the sums of the pixels, of the squared pixels and of the products
+ * are kept. The inner loops run along whole rows on plain arrays marked
+ * __restrict so the compiler can vectorize them; the Makefile builds this
+ * file with -O3 for that. The rows of windows are split between threads.
+ *****************************************************************************/
+
+//Include statements
+#include "quality.h"
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+///Sums over one 4 x 4 block of both images
+struct BlockSums
+{
+	///Sum of the first and of the second image's pixels
+	double s1, s2;
+
+	///Sum of the squares of both images' pixels
+	double ss;
+
+	///Sum of the products of the pixels
+	double s12;
+};
+
+ /**************************************************************************//**
+ * @par Description:
+ * Adds one row of both images to the column sums. The pointers are
+ * parameters marked __restrict so the compiler vectorizes the loop without
+ * checking at run time whether the arrays overlap.
+ *
+ * @param[in]      a - the row of the first image
+ * @param[in]      b - the row of the second image
+ * @param[in]      cols - image dimensions in columns
+ * @param[in,out]  s1 - column sums of the first image
+ * @param[in,out]  s2 - column sums of the second image
+ * @param[in,out]  ss - column sums of the squares of both images
+ * @param[in,out]  s12 - column sums of the products
+ *
+ *****************************************************************************/
+static void addRow(const unsigned char *__restrict a,
+	const unsigned char *__restrict b, int cols, int *__restrict s1,
+	int *__restrict s2, int *__restrict ss, int *__restrict s12)
+{
+	int j;
+
+	for (j = 0; j < cols; j++)
+	{
+		s1[j] += a[j];
+		s2[j] += b[j];
+		ss[j] += a[j] * a[j] + b[j] * b[j];
+		s12[j] += a[j] * b[j];
+	}
+}
+
+ /**************************************************************************//**
+ * @par Description:
+ * Sums the blocks of one row of 4 x 4 blocks. The pixels are first added up
+ * down each column, then across every 4 columns.
+ *
+ * @param[in]      first - the first image
+ * @param[in]      second - the second image
+ * @param[in]      cols - image dimensions in columns
+ * @param[in]      row - the bottom pixel row of the blocks
+ * @param[out]     columns - scratch space for 4 * cols column sums
+ * @param[out]     blocks - cols / 4 block sums
+ *
+ *****************************************************************************/
+static void sumBlocks(const unsigned char *first, const unsigned char *second,
+	int cols, int row, int *columns, BlockSums *blocks)
+{
+	const int *s1 = columns;
+	const int *s2 = columns + cols;
+	const int *ss = columns + 2 * cols;
+	const int *s12 = columns + 3 * cols;
+	int i, j;
+
+	fill_n(columns, 4 * size_t(cols), 0);
+	for (i = 0; i < 4; i++)
+		addRow(first + size_t(row + i) * cols, second + size_t(row + i) * cols,
+			cols, columns, columns + cols, columns + 2 * cols,
+			columns + 3 * cols);
+
+	for (j = 0; j < cols / 4; j++)
+	{
+		blocks[j].s1 = s1[4 * j] + s1[4 * j + 1] + s1[4 * j + 2] + s1[4 * j + 3];
+		blocks[j].s2 = s2[4 * j] + s2[4 * j + 1] + s2[4 * j + 2] + s2[4 * j + 3];
+		blocks[j].ss = ss[4 * j] + ss[4 * j + 1] + ss[4 * j + 2] + ss[4 * j + 3];
+		blocks[j].s12 = s12[4 * j] + s12[4 * j + 1] + s12[4 * j + 2] +
+			s12[4 * j + 3];
+	}
+}
+
+ /**************************************************************************//**
+ * @par Description:
+ * Adds up the SSIM of the windows in a range of window rows. Window row w
+ * covers block rows w and w + 1.
+ *
+ * @param[in]      first - the first image
+ * @param[in]      second - the second image
+ * @param[in]      cols - image dimensions in columns
+ * @param[in]      begin - the first window row
+ * @param[in]      end - one past the last window row
+ * @param[out]     total - the sum of the SSIM of the windows
+ *
+ *****************************************************************************/
+static void ssimRows(const unsigned char *first, const unsigned char *second,
+	int cols, int begin, int end, double *total)
+{
+	//Constants of the SSIM formula for 8-bit pixels, scaled to sums of 64
+	const double c1 = 0.01 * 0.01 * 255 * 255 * 64 * 64;
+	const double c2 = 0.03 * 0.03 * 255 * 255 * 64 * 63;
+	int blocks = cols / 4;
+	vector<BlockSums> lower(blocks), upper(blocks);
+	vector<int> columns(4 * size_t(cols));
+	double s1, s2, ss, s12, vars, covar;
+	double sum = 0;
+	int w, j;
+
+	if (begin < end)
+		sumBlocks(first, second, cols, 4 * begin, columns.data(),
+			upper.data());
+	for (w = begin; w < end; w++)
+	{
+		lower.swap(upper);
+		sumBlocks(first, second, cols, 4 * (w + 1), columns.data(),
+			upper.data());
+
+		for (j = 0; j + 1 < blocks; j++)
+		{
+			s1 = lower[j].s1 + lower[j + 1].s1 + upper[j].s1 + upper[j + 1].s1;
+			s2 = lower[j].s2 + lower[j + 1].s2 + upper[j].s2 + upper[j + 1].s2;
+			ss = lower[j].ss + lower[j + 1].ss + upper[j].ss + upper[j + 1].ss;
+			s12 = lower[j].s12 + lower[j + 1].s12 + upper[j].s12 +
+				upper[j + 1].s12;
+
+			vars = ss * 64 - s1 * s1 - s2 * s2;
+			covar = s12 * 64 - s1 * s2;
+			sum += (2 * s1 * s2 + c1) * (2 * covar + c2) /
+				((s1 * s1 + s2 * s2 + c1) * (vars + c2));
+		}
+	}
+	*total = sum;
+}
+
+ /**************************************************************************//**
+ * @par Description:
+ * Returns the mean SSIM of two 8-bit images of the same size over 8 x 8
+ * windows spaced 4 pixels apart. Rows and columns past the last full
+ * window are left out. 1 means the images are the same.
+ *
+ * @param[in]      first - the first image, rows x cols
+ * @param[in]      second - the second image, rows x cols
+ * @param[in]      rows - image dimensions in rows
+ * @param[in]      cols - image dimensions in columns
+ * @param[in]      threads - number of threads to use
+ *
+ * @returns the mean SSIM, 1 for images smaller than a window
+ *
+ *****************************************************************************/
+double ssim(const unsigned char *first, const unsigned char *second,
+	int rows, int cols, int threads)
+{
+	int windowRows = rows / 4 - 1;
+	int windowCols = cols / 4 - 1;
+	vector<thread> pool;
+	vector<double> totals;
+	double total = 0;
+	int begin, end;
+	int i;
+
+	if (windowRows < 1 || windowCols < 1)
+		return 1;
+
+	threads = max(1, min(threads, windowRows));
+	totals.resize(threads);
+	for (i = 0; i < threads; i++)
+	{
+		begin = windowRows * i / threads;
+		end = windowRows * (i + 1) / threads;
+		pool.push_back(thread(ssimRows, first, second, cols, begin, end,
+			&totals[i]));
+	}
+	for (i = 0; i < threads; i++)
+	{
+		pool[i].join();
+		total += totals[i];
+	}
+	return total / (double(windowRows) * windowCols);
+}
@@ -0,0 +1,17 @@
+/**
+ *  @file
+ *  @brief Image quality measures that need the decoded image.
+ *
+ *  The mean squared error and PSNR of a tree come from the tree itself
+ *  (quadTree::mse, quadTree::psnr). SSIM compares local structure, so it is
+ *  computed here from the original and decoded images.
+ */
+
+#ifndef _quality_H_
+#define _quality_H_
+
+///Returns the mean SSIM of two 8-bit images over 8 x 8 windows
+double ssim(const unsigned char *first, const unsigned char *second,
+	int rows, int cols, int threads);
+
+#endif
@@ -0,0 +1,176 @@
+/**************************************************************************//**
+ * @file
+ * @brief The implementation of the quadtree encoder instrumentation. Only
+ * compiled in when QT_STATS is defined.
+ *****************************************************************************/
+
+#include "treeStats.h"
+
+#ifdef QT_STATS
+
+#include <cstdio>
+#include <iomanip>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+///Counters and time for one level of the tree
+struct LevelStats
+{
+	///Nodes created on this level
+	long long nodes = 0;
+
+	///Leaves created on this level
+	long long leaves = 0;
+
+	///Pixels covered by the valueMatch tests on this level
+	long long pixels = 0;
+
+	///Seconds spent building the subtrees rooted on this level
+	double seconds = 0;
+};
+
+///A timed stage of the program
+struct PhaseStats
+{
+	///Name of the stage
+	const char *name;
+
+	///Start of the stage
+	statsTime start;
+
+	///Seconds the stage took
+	double seconds;
+};
+
+///Statistics of every level of the tree, index 0 is the root
+static vector<LevelStats> levels;
+
+///Every stage recorded so far, in the order they finished
+static vector<PhaseStats> phases;
+
+///Time the first record was made, used as time zero of the trace
+static statsTime epoch = steady_clock::now();
+
+ /**************************************************************************//**
+ * @par Description:
+ * Records one node built by fillTree. Called when the node and all of its
+ * children are finished, so the time covers the whole subtree.
+ *
+ * @param[in]      level - the level of the node
+ * @param[in]      pixels - the number of pixels in the node's region
+ * @param[in]      leaf - true if the node is a leaf
+ * @param[in]      start - the time fillTree started on the node
+ *
+ *****************************************************************************/
+void statsNode(int level, long long pixels, bool leaf, statsTime start)
+{
+	if (level >= (int) levels.size())
+		levels.resize(level + 1);
+
+	levels[level].nodes++;
+	levels[level].leaves += leaf;
+	levels[level].pixels += pixels;
+	levels[level].seconds +=
+		duration<double>(steady_clock::now() - start).count();
+}
+
+ /**************************************************************************//**
+ * @par Description:
+ * Records a stage of the program that ran from start until now
+ *
+ * @param[in]      name - the name of the stage
+ * @param[in]      start - the time the stage started
+ *
+ *****************************************************************************/
+void statsPhase(const char *name, statsTime start)
+{
+	PhaseStats phase;
+
+	phase.name = name;
+	phase.start = start;
+	phase.seconds = duration<double>(steady_clock::now() - start).count();
+	phases.push_back(phase);
+}
+
+ /**************************************************************************//**
+ * @par Description:
+ * Prints the time of every stage and a table with one row per level of the
+ * tree. The split rate is the fraction of valueMatch tests that divided the
+ * region. Subtree time covers the level and everything below it, self time
+ * is the subtree time minus the subtree time of the next level.
+ *
+ * @param[in,out]  out - the stream to print to
+ *
+ *****************************************************************************/
+void statsReport(ostream &out)
+{
+	unsigned int i;
+	double below;
+
+	out << "stage        ms" << endl;
+	for (i = 0; i < phases.size(); i++)
+		out << left << setw(10) << phases[i].name << right << setw(8)
+			<< fixed << setprecision(3) << 1000 * phases[i].seconds << endl;
+
+	out << "level     nodes    leaves      pixels  split%  subtree ms"
+		"   self ms" << endl;
+	for (i = 0; i < levels.size(); i++)
+	{
+		below = i + 1 < levels.size() ? levels[i + 1].seconds : 0;
+		out << setw(5) << i << setw(10) << levels[i].nodes
+			<< setw(10) << levels[i].leaves << setw(12) << levels[i].pixels
+			<< setw(8) << setprecision(1)
+			<< 100.0 * (levels[i].nodes - levels[i].leaves) / levels[i].nodes
+			<< setw(12) << setprecision(3) << 1000 * levels[i].seconds
+			<< setw(10) << 1000 * (levels[i].seconds - below) << endl;
+	}
+}
+
+ /**************************************************************************//**
+ * @par Description:
+ * Writes the recorded stages as complete events of a Chrome trace file. The
+ * statistics of every level are attached to the build stage as arguments.
+ *
+ * @param[in]      filename - the trace file to write
+ *
+ * @returns true if the file was written, false otherwise
+ *
+ *****************************************************************************/
+bool statsTrace(const char *filename)
+{
+	FILE *fout = fopen(filename, "w");
+	unsigned int i, j;
+
+	if (fout == NULL)
+		return false;
+
+	fprintf(fout, "{\"traceEvents\": [\n");
+	for (i = 0; i < phases.size(); i++)
+	{
+		fprintf(fout, "%s  {\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, "
+			"\"tid\": 1, \"ts\": %.3f, \"dur\": %.3f", i ? ",\n" : "",
+			phases[i].name,
+			duration<double, micro>(phases[i].start - epoch).count(),
+			1e6 * phases[i].seconds);
+
+		if (string(phases[i].name) == "build")
+		{
+			fprintf(fout, ", \"args\": {");
+			for (j = 0; j < levels.size(); j++)
+				fprintf(fout, "%s\"level %u\": {\"nodes\": %lld, \"leaves\": "
+					"%lld, \"pixels\": %lld, \"subtree_us\": %.3f}",
+					j ? ", " : "", j, levels[j].nodes, levels[j].leaves,
+					levels[j].pixels, 1e6 * levels[j].seconds);
+			fprintf(fout, "}");
+		}
+		fprintf(fout, "}");
+	}
+	fprintf(fout, "\n]}\n");
+
+	return fclose(fout) == 0;
+}
+
+#endif
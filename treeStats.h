@@ -0,0 +1,67 @@
+/**
+ *  @file
+ *  @brief Optional instrumentation of the quadtree encoder.
+ *
+ *  When compiled with QT_STATS defined (make stats) the encoder records, for
+ *  every level of the tree, the nodes visited, the leaves created, the pixels
+ *  covered by valueMatch tests, how many of those tests divided the region
+ *  and the time spent building the subtrees on that level. The main stages
+ *  of the program (load, convert, build, decode for QT_SSIM, and render of
+ *  the first frame) are timed as well. The results are printed as a report
+ *  or written as a Chrome trace file (chrome://tracing, Perfetto) once the
+ *  first frame has been drawn.
+ *
+ *  Without QT_STATS every macro below expands to nothing, so the encoder
+ *  is compiled exactly as if the instrumentation was not there.
+ */
+#ifndef _tree_Stats_
+#define _tree_Stats_
+
+#ifdef QT_STATS
+
+#include <chrono>
+#include <ostream>
+
+///Time point used by the instrumentation
+typedef std::chrono::steady_clock::time_point statsTime;
+
+///Records one node built by fillTree
+void statsNode(int level, long long pixels, bool leaf, statsTime start);
+
+///Records a stage of the program that ran from start until now
+void statsPhase(const char *name, statsTime start);
+
+///Prints the per-level and per-stage statistics
+void statsReport(std::ostream &out);
+
+///Writes the recorded stages and levels as a Chrome trace file
+bool statsTrace(const char *filename);
+
+///Declares a time point named var holding the current time
+#define STATS_START(var) statsTime var = std::chrono::steady_clock::now()
+
+///Records a node of the tree, see statsNode
+#define STATS_NODE(level, pixels, leaf, start) \
+	statsNode(level, pixels, leaf, start)
+
+///Records a stage of the program, see statsPhase
+#define STATS_PHASE(name, start) statsPhase(name, start)
+
+///Prints the report, and writes a trace if QT_TRACE names a file
+#define STATS_REPORT(out) \
+	do { \
+		statsReport(out); \
+		if (getenv("QT_TRACE")) \
+			statsTrace(getenv("QT_TRACE")); \
+	} while (0)
+
+#else
+
+#define STATS_START(var)
+#define STATS_NODE(level, pixels, leaf, start)
+#define STATS_PHASE(name, start)
+#define STATS_REPORT(out)
+
+#endif
+
+#endif